@@ -0,0 +1,167 @@
+#ifndef ANALYSIS_CACHE_H
+#define ANALYSIS_CACHE_H
+
+#include <assert.h>
+#include <stdint.h>
+#include <atomic>
+#include "board_masks.h"
+
+/*
+ * Lock-free, fixed-size cache of position analyses shared by every thread.
+ *
+ * Each slot is a single 32 bit word updated with compare-and-swap, so an
+ * entry is always read and written whole:
+ *    0..17  position key (computer mask | player mask << 9)
+ *   18..19  value for the side to move (0 = loss, 1 = draw, 2 = win)
+ *   20..23  best tile index (ANALYSIS_NO_MOVE on finished positions)
+ *   31      slot in use
+ *
+ * Lookups and inserts probe a bounded window of slots. When the window is
+ * full the entry with the most tiles on the board is evicted: it has the
+ * smallest subtree, so it is the cheapest one to compute again.
+ */
+
+#define ANALYSIS_CACHE_SIZE 4096 // must be a power of two
+#define ANALYSIS_CACHE_PROBES 8
+#define ANALYSIS_NO_MOVE 0xF
+
+#define ANALYSIS_KEY_BITS 0x3FFFF
+#define ANALYSIS_VALUE_SHIFT 18
+#define ANALYSIS_MOVE_SHIFT 20
+#define ANALYSIS_IN_USE 0x80000000u
+
+enum AnalysisValue {
+  ANALYSIS_LOSS = 0, ANALYSIS_DRAW, ANALYSIS_WIN
+};
+
+struct AnalysisCacheStats {
+  uint64_t hits;
+  uint64_t misses;
+  uint64_t inserts;
+  uint64_t evictions;
+  uint64_t entries;
+  uint64_t memoryBytes;
+};
+
+struct AnalysisCache {
+  std::atomic<uint32_t> slots[ANALYSIS_CACHE_SIZE];
+  std::atomic<uint64_t> hits;
+  std::atomic<uint64_t> misses;
+  std::atomic<uint64_t> inserts;
+  std::atomic<uint64_t> evictions;
+  std::atomic<uint64_t> entries;
+};
+
+static uint32_t
+analysisKey(uint32_t computerMask, uint32_t playerMask) {
+  return computerMask | (playerMask << 9);
+}
+
+static uint32_t
+analysisSlotIndex(uint32_t key) {
+  return (key * 2654435761u) & (ANALYSIS_CACHE_SIZE - 1);
+}
+
+static void
+analysisCacheInit(AnalysisCache* cache) {
+  for (int index = 0; index < ANALYSIS_CACHE_SIZE; ++index) {
+    cache->slots[index].store(0, std::memory_order_relaxed);
+  }
+  cache->hits.store(0, std::memory_order_relaxed);
+  cache->misses.store(0, std::memory_order_relaxed);
+  cache->inserts.store(0, std::memory_order_relaxed);
+  cache->evictions.store(0, std::memory_order_relaxed);
+  cache->entries.store(0, std::memory_order_relaxed);
+}
+
+/*
+ * Returns true and fills value/bestTile when key is cached. Does not touch
+ * the hit/miss counters, for callers that poll the cache or probe it while
+ * solving and would otherwise drown the real lookups.
+ */
+static bool
+analysisCachePeek(AnalysisCache* cache, uint32_t key,
+                  AnalysisValue* value, int* bestTile) {
+  assert((key & ~ANALYSIS_KEY_BITS) == 0);
+  uint32_t index = analysisSlotIndex(key);
+  for (int probe = 0; probe < ANALYSIS_CACHE_PROBES; ++probe) {
+    uint32_t entry = cache->slots[(index + probe) & (ANALYSIS_CACHE_SIZE - 1)]
+                       .load(std::memory_order_acquire);
+    if ((entry & ANALYSIS_IN_USE) && (entry & ANALYSIS_KEY_BITS) == key) {
+      *value = (AnalysisValue) ((entry >> ANALYSIS_VALUE_SHIFT) & 3);
+      *bestTile = (int) ((entry >> ANALYSIS_MOVE_SHIFT) & 0xF);
+      return true;
+    }
+  }
+  return false;
+}
+
+/*
+ * Same as analysisCachePeek, counting the result as a hit or a miss.
+ */
+static bool
+analysisCacheLookup(AnalysisCache* cache, uint32_t key,
+                    AnalysisValue* value, int* bestTile) {
+  if (analysisCachePeek(cache, key, value, bestTile)) {
+    cache->hits.fetch_add(1, std::memory_order_relaxed);
+    return true;
+  }
+  cache->misses.fetch_add(1, std::memory_order_relaxed);
+  return false;
+}
+
+static void
+analysisCacheInsert(AnalysisCache* cache, uint32_t key,
+                    AnalysisValue value, int bestTile) {
+  assert((key & ~ANALYSIS_KEY_BITS) == 0);
+  uint32_t newEntry = ANALYSIS_IN_USE | key |
+                      ((uint32_t) value << ANALYSIS_VALUE_SHIFT) |
+                      ((uint32_t) (bestTile & 0xF) << ANALYSIS_MOVE_SHIFT);
+  uint32_t index = analysisSlotIndex(key);
+  std::atomic<uint32_t>* victim = 0;
+  uint32_t victimEntry = 0;
+  int victimTileCount = 0;
+  for (int probe = 0; probe < ANALYSIS_CACHE_PROBES; ++probe) {
+    std::atomic<uint32_t>* slot = &cache->slots[(index + probe) & (ANALYSIS_CACHE_SIZE - 1)];
+    uint32_t entry = slot->load(std::memory_order_acquire);
+    if ((entry & ANALYSIS_IN_USE) == 0) {
+      if (slot->compare_exchange_strong(entry, newEntry, std::memory_order_release,
+                                        std::memory_order_acquire)) {
+        cache->inserts.fetch_add(1, std::memory_order_relaxed);
+        cache->entries.fetch_add(1, std::memory_order_relaxed);
+        return;
+      }
+      // Lost the race for this slot, entry now holds the winner.
+    }
+    if ((entry & ANALYSIS_KEY_BITS) == key) {
+      return;
+    }
+    int tileCount = countBits(entry & ANALYSIS_KEY_BITS);
+    if (victim == 0 || tileCount > victimTileCount) {
+      victim = slot;
+      victimEntry = entry;
+      victimTileCount = tileCount;
+    }
+  }
+  // A failed exchange means another thread replaced the victim first; the
+  // result is simply not cached this time.
+  if (victim->compare_exchange_strong(victimEntry, newEntry, std::memory_order_release,
+                                      std::memory_order_relaxed)) {
+    cache->inserts.fetch_add(1, std::memory_order_relaxed);
+    cache->evictions.fetch_add(1, std::memory_order_relaxed);
+  }
+}
+
+static AnalysisCacheStats
+analysisCacheStats(AnalysisCache* cache) {
+  AnalysisCacheStats stats;
+  stats.hits = cache->hits.load(std::memory_order_relaxed);
+  stats.misses = cache->misses.load(std::memory_order_relaxed);
+  stats.inserts = cache->inserts.load(std::memory_order_relaxed);
+  stats.evictions = cache->evictions.load(std::memory_order_relaxed);
+  stats.entries = cache->entries.load(std::memory_order_relaxed);
+  stats.memoryBytes = sizeof(AnalysisCache);
+  return stats;
+}
+
+#endif
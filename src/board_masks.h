@@ -0,0 +1,36 @@
+#ifndef BOARD_MASKS_H
+#define BOARD_MASKS_H
+
+#include <stdint.h>
+
+/*
+ * Boards as 9 bit tile masks, one per side (bit = row * 3 + column).
+ */
+
+#define BOARD_MASK 0x1FF
+
+// Tile masks of every row, column and diagonal.
+static const uint32_t LINE_MASKS[8] = {
+  0x007, 0x038, 0x1C0, 
+  0x049, 0x092, 0x124, 
+  0x111, 0x054
+};
+
+// Lines through every tile, as bits indexing LINE_MASKS.
+static const uint32_t TILE_LINES[9] = {
+  0x49, 0x11, 0xA1, 
+  0x0A, 0xD2, 0x22, 
+  0x8C, 0x14, 0x64
+};
+
+static int
+countBits(uint32_t value) {
+  int count = 0;
+  while (value) {
+    value &= value - 1;
+    ++count;
+  }
+  return count;
+}
+
+#endif
@@ -9,5 +9,6 @@ CommonFlags="-Wall -Werror -Wno-unused-variable -Wno-unused-function -Wno-writab
 	-DBUILD_OSX=1 -framework SDL2"
 
 c++ $CommonFlags ../src/main.cpp -o tic-tac-toe -g 
+c++ $CommonFlags ../src/trap_check.cpp -o trap-check -g 
 
 popd
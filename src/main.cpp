@@ -7,9 +7,16 @@
 #include <time.h>
 #include <stdlib.h>
 #include "res_path.h"
+#include "board_masks.h"
+#include "session_store.h"
+#include "analysis_cache.h"
+#include "metrics.h"
 
 #ifdef BUILD_WIN32
 #include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
 #endif
 
 #define SCREEN_WIDTH 640
@@ -18,6 +25,18 @@
 #define LEFT_SCREEN_MARGIN 100
 #define TILE_PIXEL_SIZE 120
 
+#define SPECTATOR_DEFAULT_BOARDS 400
+#define SPECTATOR_BOARD_GAP 2
+#define SPECTATOR_MOVE_FRAMES 6
+#define SPECTATOR_RESTART_FRAMES 90
+#define SPECTATOR_FRAME_MS 16
+
+#define PERFT_MAX_THREADS 64
+#define PERFT_POSITION_WORDS ((1 << 18) / 32)
+
+#define SESSION_STORE_FILENAME "sessions.dat"
+#define SESSION_STORE_RECORD_COUNT 1
+
 enum TileValue {
   EMPTY_TILE = 0, COMPUTER_TILE, PLAYER_TILE
 };
@@ -28,6 +47,7 @@ enum  GameEndStatus {
 
 struct PlayerInput {
   bool keyPressed[3][3];
+  bool showHints;
 };
   
 struct GameState {
@@ -42,6 +62,85 @@ struct SpriteSheet {
   SDL_Rect clips[7];
 };
 
+static void
+gameStateReset(GameState* gameState) {
+  *gameState = {};
+  gameState->freeTilesCount = 9;  
+  gameState->running = true;
+  gameState->endStatus = NO_END;
+}
+
+static void
+gameBoardMasks(GameState* gameState, uint32_t* computerMask, uint32_t* playerMask) {
+  uint32_t computerTiles = 0;
+  uint32_t playerTiles = 0;
+  for (int row = 0; row < 3; ++row) {
+    for (int column = 0; column < 3; ++column) {
+      TileValue tileValue = gameState->board[row][column];
+      computerTiles |= (uint32_t) (tileValue == COMPUTER_TILE) << (row * 3 + column);
+      playerTiles |= (uint32_t) (tileValue == PLAYER_TILE) << (row * 3 + column);
+    }
+  }
+  *computerMask = computerTiles;
+  *playerMask = playerTiles;
+}
+
+/*
+ * The player always opens, so the computer is to move whenever the player
+ * has placed more tiles.
+ */
+static bool
+gameComputerToMove(uint32_t computerMask, uint32_t playerMask) {
+  return countBits(playerMask) > countBits(computerMask);
+}
+
+static uint32_t
+gameStatePack(GameState* gameState) {
+  uint32_t computerMask;
+  uint32_t playerMask;
+  gameBoardMasks(gameState, &computerMask, &playerMask);
+  uint32_t computerToMove = gameComputerToMove(computerMask, playerMask);
+  return sessionRecordPack(computerMask, playerMask, computerToMove, 
+                           gameState->endStatus);
+}
+
+static void
+gameStateUnpack(GameState* gameState, uint32_t record) {
+  gameStateReset(gameState);
+  uint32_t computerMask = sessionRecordComputerMask(record);
+  uint32_t playerMask = sessionRecordPlayerMask(record);
+  for (int row = 0; row < 3; ++row) {
+    for (int column = 0; column < 3; ++column) {
+      uint32_t bit = 1u << (row * 3 + column);
+      if (computerMask & bit) {
+        gameState->board[row][column] = COMPUTER_TILE;
+        --gameState->freeTilesCount;
+      } else if (playerMask & bit) {
+        gameState->board[row][column] = PLAYER_TILE;
+        --gameState->freeTilesCount;
+      }
+    }
+  }
+  gameState->endStatus = (GameEndStatus) sessionRecordEndStatus(record);
+}
+
+/*
+ * Every move, from either side, goes through here.
+ */
+static void
+gameApplyMove(GameState* gameState, int row, int column, TileValue tileValue) {
+  assert(gameState->board[row][column] == EMPTY_TILE);
+  gameState->board[row][column] = tileValue;
+  --gameState->freeTilesCount;
+}
+
+static void
+gameStateSave(GameState* gameState, SessionStore* sessionStore) {
+  if (sessionStore->header) {
+    sessionStoreSave(sessionStore, 0, gameStatePack(gameState));
+  }
+}
+
 
 
 SDL_Texture *
@@ -71,17 +170,82 @@ sdlLoadTexture(char* resourcePath, char* filename, SDL_Renderer *ren) {
   return tex;
 }
 
-static void
-sdlRenderGame(GameState* gameState, SDL_Renderer *ren, SpriteSheet* spriteSheet) {
+/*
+ * Returns a malloc'd path to filename in the per-user preferences folder.
+ */
+static char*
+sdlGetPrefFilePath(char* filename) {
+  char* prefPath = SDL_GetPrefPath("jabelardo", "TicTacToe");
+  if (prefPath == 0) {
+    fprintf(stderr, "SDL_GetPrefPath Error: %s\n", SDL_GetError());
+    return 0;
+  }
+  char* filePath = (char*) malloc(strlen(prefPath) + strlen(filename) + 1);
+  if (filePath) {
+    strcpy(filePath, prefPath);
+    strcat(filePath, filename);
+  } else {
+    fprintf(stderr,"malloc failed!\n");
+  }
+  SDL_free(prefPath);
+  return filePath;
+}
 
-  SDL_SetRenderDrawColor(ren, 0xFF, 0xFF, 0xFF, 0xFF);
-  SDL_RenderClear(ren);
+/*
+ * Shades every empty tile by the outcome the player gets by taking it, as far
+ * as the analysis cache knows; tiles not analyzed yet are left alone.
+ */
+static void
+sdlRenderHints(GameState* gameState, SDL_Renderer *ren, AnalysisCache* analysisCache) {
+  if (gameState->endStatus != NO_END) {
+    return;
+  }
+  uint32_t computerMask;
+  uint32_t playerMask;
+  gameBoardMasks(gameState, &computerMask, &playerMask);
 
+  SDL_SetRenderDrawBlendMode(ren, SDL_BLENDMODE_BLEND);
   for (int row = 0; row < 3; ++row) {
     for (int column = 0; column < 3; ++column) {
+      if (gameState->board[row][column] != EMPTY_TILE) {
+        continue;
+      }
+      uint32_t key = analysisKey(computerMask, playerMask | (1u << (row * 3 + column)));
+      AnalysisValue computerValue;
+      int bestTile;
+      if (!analysisCachePeek(analysisCache, key, &computerValue, &bestTile)) {
+        continue;
+      }
+      switch (computerValue) {
+        case ANALYSIS_LOSS: {
+          SDL_SetRenderDrawColor(ren, 0x40, 0xC0, 0x40, 0x60);
+        } break;
+
+        case ANALYSIS_DRAW: {
+          SDL_SetRenderDrawColor(ren, 0xE0, 0xC0, 0x20, 0x60);
+        } break;
+
+        default: {
+          SDL_SetRenderDrawColor(ren, 0xE0, 0x40, 0x40, 0x60);
+        }
+      }
       int screenX = LEFT_SCREEN_MARGIN + column * TILE_PIXEL_SIZE;
       int screenY = TOP_SCREEN_MARGIN + row * TILE_PIXEL_SIZE;
-      SDL_Rect dstrect = {screenX, screenY, TILE_PIXEL_SIZE, TILE_PIXEL_SIZE};
+      SDL_Rect hintRect = {screenX, screenY, TILE_PIXEL_SIZE, TILE_PIXEL_SIZE};
+      SDL_RenderFillRect(ren, &hintRect);
+    }
+  }
+  SDL_SetRenderDrawBlendMode(ren, SDL_BLENDMODE_NONE);
+}
+
+static void
+sdlRenderBoard(GameState* gameState, SDL_Renderer *ren, SpriteSheet* spriteSheet,
+               int left, int top, int tileSize) {
+  for (int row = 0; row < 3; ++row) {
+    for (int column = 0; column < 3; ++column) {
+      int screenX = left + column * tileSize;
+      int screenY = top + row * tileSize;
+      SDL_Rect dstrect = {screenX, screenY, tileSize, tileSize};
       SDL_Rect* srcrect;
       switch (gameState->board[row][column]) {
         case COMPUTER_TILE: {
@@ -101,6 +265,20 @@ sdlRenderGame(GameState* gameState, SDL_Renderer *ren, SpriteSheet* spriteSheet)
       SDL_RenderCopy(ren, spriteSheet->texture, srcrect, &dstrect);
     }
   }
+}
+
+static void
+sdlRenderGame(GameState* gameState, SDL_Renderer *ren, SpriteSheet* spriteSheet,
+              AnalysisCache* analysisCache, bool showHints) {
+
+  SDL_SetRenderDrawColor(ren, 0xFF, 0xFF, 0xFF, 0xFF);
+  SDL_RenderClear(ren);
+
+  sdlRenderBoard(gameState, ren, spriteSheet, 
+                 LEFT_SCREEN_MARGIN, TOP_SCREEN_MARGIN, TILE_PIXEL_SIZE);
+  if (showHints) {
+    sdlRenderHints(gameState, ren, analysisCache);
+  }
   SDL_RenderPresent(ren);
 }
 
@@ -157,8 +335,7 @@ gameUpdateLineMoveRow(GameState* gameState, TileValue tileValue,
   if (gameState->board[row][columnA] == tileValue &&
       gameState->board[row][columnA] == gameState->board[row][columnB] &&
       gameState->board[row][columnC] == EMPTY_TILE) {
-    gameState->board[row][columnC] = COMPUTER_TILE;  
-    --gameState->freeTilesCount;  
+    gameApplyMove(gameState, row, columnC, COMPUTER_TILE);
     return true;
   } 
   return false;
@@ -171,8 +348,7 @@ gameUpdateLineMoveColumn(GameState* gameState, TileValue tileValue,
   if (gameState->board[rowA][column] == tileValue &&
       gameState->board[rowA][column] == gameState->board[rowB][column] &&
       gameState->board[rowC][column] == EMPTY_TILE) {
-    gameState->board[rowC][column] = COMPUTER_TILE;  
-    --gameState->freeTilesCount;  
+    gameApplyMove(gameState, rowC, column, COMPUTER_TILE);
     return true;
   } 
   return false;
@@ -185,8 +361,7 @@ gameUpdateLineMoveDiagonal(GameState* gameState, TileValue tileValue,
   if (gameState->board[cellA][cellA] == tileValue &&
       gameState->board[cellA][cellA] == gameState->board[cellB][cellB] &&
       gameState->board[cellC][cellC] == EMPTY_TILE) {
-    gameState->board[cellC][cellC] = COMPUTER_TILE;  
-    --gameState->freeTilesCount;  
+    gameApplyMove(gameState, cellC, cellC, COMPUTER_TILE);
     return true;
   } 
   return false;
@@ -202,8 +377,7 @@ gameUpdateLineMoveInvDiagonal(GameState* gameState, TileValue tileValue,
   if (gameState->board[rowA][columnA] == tileValue &&
       gameState->board[rowA][columnA] == gameState->board[rowB][columnB] &&
       gameState->board[rowC][columnC] == EMPTY_TILE) {
-    gameState->board[rowC][columnC] = COMPUTER_TILE;  
-    --gameState->freeTilesCount;  
+    gameApplyMove(gameState, rowC, columnC, COMPUTER_TILE);
     return true;
   } 
   return false;
@@ -215,23 +389,19 @@ gameUpdateComputerCornerMove(GameState* gameState) {
     return false;
   }
   if (gameState->board[0][0] == EMPTY_TILE) {
-    gameState->board[0][0] = COMPUTER_TILE;  
-    --gameState->freeTilesCount;  
+    gameApplyMove(gameState, 0, 0, COMPUTER_TILE);
     return true;
   }
   if (gameState->board[0][2] == EMPTY_TILE) {
-    gameState->board[0][2] = COMPUTER_TILE;  
-    --gameState->freeTilesCount;  
+    gameApplyMove(gameState, 0, 2, COMPUTER_TILE);
     return true;
   }
   if (gameState->board[2][2] == EMPTY_TILE) {
-    gameState->board[2][2] = COMPUTER_TILE;  
-    --gameState->freeTilesCount;  
+    gameApplyMove(gameState, 2, 2, COMPUTER_TILE);
     return true;
   }
   if (gameState->board[2][0] == EMPTY_TILE) {
-    gameState->board[2][0] = COMPUTER_TILE;  
-    --gameState->freeTilesCount;  
+    gameApplyMove(gameState, 2, 0, COMPUTER_TILE);
     return true;
   }
   return false;
@@ -243,23 +413,19 @@ gameUpdatePlayerCornerMove(GameState* gameState) {
     return false;
   }
   if (gameState->board[0][0] == PLAYER_TILE) {
-    gameState->board[1][1] = COMPUTER_TILE;  
-    --gameState->freeTilesCount;  
+    gameApplyMove(gameState, 1, 1, COMPUTER_TILE);
     return true;
   }
   if (gameState->board[0][2] == PLAYER_TILE) {
-    gameState->board[1][1] = COMPUTER_TILE;  
-    --gameState->freeTilesCount;  
+    gameApplyMove(gameState, 1, 1, COMPUTER_TILE);
     return true;
   }
   if (gameState->board[2][2] == PLAYER_TILE) {
-    gameState->board[1][1] = COMPUTER_TILE;  
-    --gameState->freeTilesCount;  
+    gameApplyMove(gameState, 1, 1, COMPUTER_TILE);
     return true;
   }
   if (gameState->board[2][0] == PLAYER_TILE) {
-    gameState->board[1][1] = COMPUTER_TILE;  
-    --gameState->freeTilesCount;  
+    gameApplyMove(gameState, 1, 1, COMPUTER_TILE);
     return true;
   }
   return false;
@@ -294,124 +460,138 @@ gameUpdateLineMove(GameState* gameState, TileValue tileValue) {
   return false;
 }
 
-static bool
-gameUpdateTrapMoveNoCenter(GameState* gameState, TileValue tileValue, 
-                                  int rowA, int columnA) {
+/*
+ * Lines are bits indexing LINE_MASKS. An open line holds one tile of a side
+ * and nothing else; a fork tile is an empty tile on two open lines of the
+ * same side, where that side makes two threats at once.
+ */
+struct GameLines {
+  uint32_t computerLines;
+  uint32_t playerLines;
+  uint32_t emptyLines;
+  uint32_t computerForkTiles;
+  uint32_t playerForkTiles;
+};
 
-  if (gameState->board[rowA][columnA] != tileValue) {
-    return false;
-  }
-  int rowB = 1;
-  int rowC = 2;
-  switch (rowA) {
-    case 1: {
-      rowB = 0;
-      rowC = 2;
-    } break;
-    case 2: {
-      rowB = 0;
-      rowC = 1;
-    } break;
-  }
-  int columnB = 1;
-  int columnC = 2;
-  switch (columnA) {
-    case 1: {
-      columnB = 0;
-      columnC = 2;
-    } break;
-    case 2: {
-      columnB = 0;
-      columnC = 1;
-    } break;
+/*
+ * Sorts every line for both sides and collects both sides' fork tiles, all
+ * in a single pass over the lines.
+ */
+static GameLines
+gameScanLines(uint32_t computerMask, uint32_t playerMask) {
+  GameLines lines = {};
+  uint32_t computerOnce = 0;
+  uint32_t computerTwice = 0;
+  uint32_t playerOnce = 0;
+  uint32_t playerTwice = 0;
+  for (int line = 0; line < 8; ++line) {
+    uint32_t lineMask = LINE_MASKS[line];
+    uint32_t computerInLine = computerMask & lineMask;
+    uint32_t playerInLine = playerMask & lineMask;
+    if (computerInLine == 0 && playerInLine == 0) {
+      lines.emptyLines |= 1u << line;
+    } else if (playerInLine == 0 && (computerInLine & (computerInLine - 1)) == 0) {
+      lines.computerLines |= 1u << line;
+      computerTwice |= computerOnce & lineMask;
+      computerOnce |= lineMask;
+    } else if (computerInLine == 0 && (playerInLine & (playerInLine - 1)) == 0) {
+      lines.playerLines |= 1u << line;
+      playerTwice |= playerOnce & lineMask;
+      playerOnce |= lineMask;
+    }
   }
+  uint32_t emptyMask = BOARD_MASK & ~(computerMask | playerMask);
+  lines.computerForkTiles = computerTwice & emptyMask;
+  lines.playerForkTiles = playerTwice & emptyMask;
+  return lines;
+}
 
-  if (((gameState->board[rowA][columnB] == tileValue && gameState->board[rowA][columnC] == EMPTY_TILE) || 
-       (gameState->board[rowA][columnC] == tileValue && gameState->board[rowA][columnB] == EMPTY_TILE)) &&
-      gameState->board[rowB][columnA] == EMPTY_TILE &&
-      gameState->board[rowC][columnA] == EMPTY_TILE) {
-    gameState->board[rowB][columnA] = COMPUTER_TILE;  
-    --gameState->freeTilesCount;  
-    return true;
-  } 
-  if (((gameState->board[rowB][columnA] == tileValue && gameState->board[rowC][columnA] == EMPTY_TILE) || 
-       (gameState->board[rowC][columnA] == tileValue && gameState->board[rowB][columnA] == EMPTY_TILE)) &&
-      gameState->board[rowA][columnB] == EMPTY_TILE &&
-      gameState->board[rowA][columnC] == EMPTY_TILE) {
-    gameState->board[rowA][columnB] = COMPUTER_TILE;  
-    --gameState->freeTilesCount;  
-    return true;
-  } 
-  if (((gameState->board[rowA][columnB] == tileValue && gameState->board[rowA][columnC] == EMPTY_TILE) || 
-       (gameState->board[rowA][columnC] == tileValue && gameState->board[rowA][columnB] == EMPTY_TILE)) &&
-      gameState->board[rowB][columnB] == EMPTY_TILE &&
-      gameState->board[rowC][columnC] == EMPTY_TILE) {
-    gameState->board[rowB][columnB] = COMPUTER_TILE;  
-    --gameState->freeTilesCount;  
-    return true;
-  } 
-  if (((gameState->board[rowB][columnB] == tileValue && gameState->board[2][columnC] == EMPTY_TILE) || 
-       (gameState->board[rowC][columnC] == tileValue && gameState->board[rowB][columnB] == EMPTY_TILE)) &&
-      gameState->board[rowA][columnB] == EMPTY_TILE &&
-      gameState->board[rowA][columnC] == EMPTY_TILE) {
-    gameState->board[rowA][columnB] = COMPUTER_TILE;  
-    --gameState->freeTilesCount;  
-    return true;
-  } 
-  if (((gameState->board[rowB][columnA] == tileValue && gameState->board[rowC][columnA] == EMPTY_TILE) || 
-       (gameState->board[rowC][columnA] == tileValue && gameState->board[rowB][columnA] == EMPTY_TILE)) &&
-      gameState->board[rowB][columnB] == EMPTY_TILE &&
-      gameState->board[rowC][columnC] == EMPTY_TILE) {
-    gameState->board[rowB][columnB] = COMPUTER_TILE;  
-    --gameState->freeTilesCount;  
-    return true;
-  } 
-  if (((gameState->board[rowB][columnB] == tileValue && gameState->board[rowC][columnC] == EMPTY_TILE) || 
-       (gameState->board[rowC][columnC] == tileValue && gameState->board[rowB][columnB] == EMPTY_TILE)) &&
-      gameState->board[rowB][columnA] == EMPTY_TILE &&
-      gameState->board[rowC][columnA] == EMPTY_TILE) {
-    gameState->board[rowB][columnA] = COMPUTER_TILE;  
-    --gameState->freeTilesCount;  
-    return true;
-  } 
+/*
+ * Returns the empty tiles lying on at least two of openLines.
+ */
+static uint32_t
+gameForkTiles(uint32_t openLines, uint32_t emptyMask) {
+  uint32_t seenOnce = 0;
+  uint32_t seenTwice = 0;
+  for (int line = 0; line < 8; ++line) {
+    uint32_t lineMask = LINE_MASKS[line] & (0 - ((openLines >> line) & 1));
+    seenTwice |= seenOnce & lineMask;
+    seenOnce |= lineMask;
+  }
+  return seenTwice & emptyMask;
+}
 
-  return false;
+static int
+lowestBitIndex(uint32_t mask) {
+  assert(mask);
+#ifdef BUILD_WIN32
+  unsigned long index;
+  _BitScanForward(&index, mask);
+  return (int) index;
+#else
+  return __builtin_ctz(mask);
+#endif
 }
 
-static bool
-gameUpdateTrapMoveCenter(GameState* gameState, TileValue tileValue) {
-  return false;
+static void
+gameUpdatePlaceComputerTile(GameState* gameState, int tileIndex) {
+  gameApplyMove(gameState, tileIndex / 3, tileIndex % 3, COMPUTER_TILE);
 }
 
+/*
+ * Plays a fork for the computer or, failing that, defends against the
+ * player's forks: a single fork tile is simply taken; with several of them
+ * the computer makes two in a row instead, choosing a line where the forced
+ * reply leaves the player neither a double threat nor a new fork. Runs after
+ * the line stage found nothing, so neither side has two tiles in an open
+ * line and only the reply can give the player new threats.
+ */
 static bool
-gameUpdateTrapMove(GameState* gameState, TileValue tileValue) {
-  for (int row = 0; row < 3; ++row) {
-    for (int column = 0; column < 3; ++column) {
-      if ((row != 2) && (column != 2)) {
-        if (gameUpdateTrapMoveNoCenter(gameState, COMPUTER_TILE, row, column)) {
-          return true;
-        }
-      } else {
-         if (gameUpdateTrapMoveCenter(gameState, COMPUTER_TILE)) {
-          return true;
-        }
-      }
-    }
+gameUpdateTrapMove(GameState* gameState, uint32_t computerMask, uint32_t playerMask) {
+  GameLines lines = gameScanLines(computerMask, playerMask);
+  if (lines.computerForkTiles) {
+    gameUpdatePlaceComputerTile(gameState, lowestBitIndex(lines.computerForkTiles));
+    return true;
   }
-  for (int row = 0; row < 3; ++row) {
-    for (int column = 0; column < 3; ++column) {
-      if ((row != 2) && (column != 2)) {
-        if (gameUpdateTrapMoveNoCenter(gameState, PLAYER_TILE, row, column)) {
-          return true;
+  uint32_t playerForkTiles = lines.playerForkTiles;
+  if (playerForkTiles == 0) {
+    return false;
+  }
+  if ((playerForkTiles & (playerForkTiles - 1)) == 0) {
+    gameUpdatePlaceComputerTile(gameState, lowestBitIndex(playerForkTiles));
+    return true;
+  }
+  // First look for a reply that leaves the player without any fork, then
+  // settle for one that at least does not win on the spot.
+  uint32_t emptyMask = BOARD_MASK & ~(computerMask | playerMask);
+  for (int pass = 0; pass < 2; ++pass) {
+    for (int line = 0; line < 8; ++line) {
+      if (((lines.computerLines >> line) & 1) == 0) {
+        continue;
+      }
+      uint32_t candidates = LINE_MASKS[line] & emptyMask;
+      for (uint32_t moves = candidates; moves; moves &= moves - 1) {
+        uint32_t moveBit = moves & (0 - moves);
+        uint32_t replyBit = candidates & ~moveBit;
+        int moveTile = lowestBitIndex(moveBit);
+        uint32_t moveLines = TILE_LINES[moveTile];
+        uint32_t replyLines = TILE_LINES[lowestBitIndex(replyBit)];
+        uint32_t threatLines = lines.playerLines & replyLines & ~moveLines;
+        if (threatLines & (threatLines - 1)) {
+          continue;
         }
-      } else {
-         if (gameUpdateTrapMoveCenter(gameState, PLAYER_TILE)) {
-          return true;
+        uint32_t nextPlayerLines = ((lines.playerLines & ~replyLines) |
+                                    (lines.emptyLines & replyLines)) & ~moveLines;
+        if (pass == 0 && gameForkTiles(nextPlayerLines, emptyMask & ~(moveBit | replyBit))) {
+          continue;
         }
+        gameUpdatePlaceComputerTile(gameState, moveTile);
+        return true;
       }
     }
   }
-  return false;
+  gameUpdatePlaceComputerTile(gameState, lowestBitIndex(playerForkTiles));
+  return true;
 }
 
 static void
@@ -427,8 +607,7 @@ gameUpdateRandomMove(GameState* gameState) {
         continue;
       }
       if (randomTileIndex == 0) {
-        gameState->board[row][column] = COMPUTER_TILE;  
-        --gameState->freeTilesCount;  
+        gameApplyMove(gameState, row, column, COMPUTER_TILE);
         return;
       }
       --randomTileIndex;
@@ -436,19 +615,121 @@ gameUpdateRandomMove(GameState* gameState) {
   }
 }
 
+static bool
+analysisMaskHasLine(uint32_t mask) {
+  for (int line = 0; line < 8; ++line) {
+    if ((mask & LINE_MASKS[line]) == LINE_MASKS[line]) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/*
+ * Negamax over the tile masks. Returns the value of the position for the side
+ * to move, caching it together with the best tile for every node visited.
+ * Children are probed with analysisCachePeek so the cache statistics only
+ * count the top-level lookups done by analysisEvaluate.
+ */
+static AnalysisValue
+analysisSolve(AnalysisCache* analysisCache, uint32_t computerMask,
+              uint32_t playerMask, int* bestTile) {
+  AnalysisValue value;
+  bool computerToMove = gameComputerToMove(computerMask, playerMask);
+  uint32_t ownMask = computerToMove ? computerMask : playerMask;
+  uint32_t otherMask = computerToMove ? playerMask : computerMask;
+
+  *bestTile = ANALYSIS_NO_MOVE;
+  if (analysisMaskHasLine(otherMask)) {
+    value = ANALYSIS_LOSS;
+  } else if ((ownMask | otherMask) == BOARD_MASK) {
+    value = ANALYSIS_DRAW;
+  } else {
+    value = ANALYSIS_LOSS;
+    for (int tileIndex = 0; tileIndex < 9 && value != ANALYSIS_WIN; ++tileIndex) {
+      uint32_t tileBit = 1u << tileIndex;
+      if ((ownMask | otherMask) & tileBit) {
+        continue;
+      }
+      uint32_t childComputerMask = computerToMove ? (computerMask | tileBit) : computerMask;
+      uint32_t childPlayerMask = computerToMove ? playerMask : (playerMask | tileBit);
+      int childBestTile;
+      AnalysisValue childValue;
+      if (!analysisCachePeek(analysisCache, analysisKey(childComputerMask, childPlayerMask),
+                             &childValue, &childBestTile)) {
+        childValue = analysisSolve(analysisCache, childComputerMask, childPlayerMask,
+                                   &childBestTile);
+      }
+      AnalysisValue tileValue = (AnalysisValue) (ANALYSIS_WIN - childValue);
+      if (*bestTile == ANALYSIS_NO_MOVE || tileValue > value) {
+        value = tileValue;
+        *bestTile = tileIndex;
+      }
+    }
+  }
+  analysisCacheInsert(analysisCache, analysisKey(computerMask, playerMask), value, *bestTile);
+  return value;
+}
+
+/*
+ * Returns the value of the position for the side to move and its best tile,
+ * solving and caching it on a miss.
+ */
+static AnalysisValue
+analysisEvaluate(AnalysisCache* analysisCache, uint32_t computerMask, 
+                 uint32_t playerMask, int* bestTile) {
+  AnalysisValue value;
+  if (analysisCacheLookup(analysisCache, analysisKey(computerMask, playerMask),
+                          &value, bestTile)) {
+    return value;
+  }
+  return analysisSolve(analysisCache, computerMask, playerMask, bestTile);
+}
+
+/*
+ * Places the computer tile and returns the stage that chose it. With an
+ * analysis cache that is always the solved best tile, solving the position
+ * right here on a miss (at most 5,478 positions), so the move never depends
+ * on how far the background worker got. Without one it falls back to the
+ * heuristic stages.
+ */
+static MetricHistogram
+gameUpdateComputerMove(GameState* gameState, AnalysisCache* analysisCache) {
+  uint32_t computerMask;
+  uint32_t playerMask;
+  gameBoardMasks(gameState, &computerMask, &playerMask);
+  if (analysisCache) {
+    int bestTile;
+    analysisEvaluate(analysisCache, computerMask, playerMask, &bestTile);
+    assert(bestTile != ANALYSIS_NO_MOVE);
+    gameUpdatePlaceComputerTile(gameState, bestTile);
+    return METRIC_AI_DECISION_CACHE;
+  }
+  if (gameUpdateLineMove(gameState, COMPUTER_TILE) ||
+      gameUpdateLineMove(gameState, PLAYER_TILE)) {
+    return METRIC_AI_DECISION_LINE;
+  }
+  if (gameUpdateTrapMove(gameState, computerMask, playerMask)) {
+    return METRIC_AI_DECISION_TRAP;
+  }
+  if (gameUpdatePlayerCornerMove(gameState) ||
+      gameUpdateComputerCornerMove(gameState)) {
+    return METRIC_AI_DECISION_CORNER;
+  }
+  gameUpdateRandomMove(gameState);
+  return METRIC_AI_DECISION_RANDOM;
+}
+
 static void
-gameUpdateComputer(GameState* gameState) {
+gameUpdateComputer(GameState* gameState, AnalysisCache* analysisCache) {
   if (gameState->freeTilesCount == 0) {
     return;
   }
-  if (!gameUpdateLineMove(gameState, COMPUTER_TILE) &&
-      !gameUpdateLineMove(gameState, PLAYER_TILE) &&
-      !gameUpdateTrapMove(gameState, COMPUTER_TILE) &&
-      !gameUpdateTrapMove(gameState, PLAYER_TILE) &&
-      !gameUpdatePlayerCornerMove(gameState) &&
-      !gameUpdateComputerCornerMove(gameState)) {
-    gameUpdateRandomMove(gameState);
-  }
+  Uint64 decisionStart = SDL_GetPerformanceCounter();
+  MetricHistogram decisionStage = gameUpdateComputerMove(gameState, analysisCache);
+  metricsObserve(decisionStage, 
+                 metricsTicksToNanos(SDL_GetPerformanceCounter() - decisionStart));
+  metricsIncrement(METRIC_MOVES);
   gameUpdateStatus(gameState);
 }
 
@@ -473,8 +754,8 @@ gameUpdatePlayer(GameState* gameState, PlayerInput *input) {
   if (gameState->board[playerMoveRow][playerMoveColumn] != EMPTY_TILE) {
     return false;
   }
-  gameState->board[playerMoveRow][playerMoveColumn] = PLAYER_TILE;
-  --gameState->freeTilesCount;  
+  gameApplyMove(gameState, playerMoveRow, playerMoveColumn, PLAYER_TILE);
+  metricsIncrement(METRIC_MOVES);
 
   gameUpdateStatus(gameState);
 
@@ -482,9 +763,148 @@ gameUpdatePlayer(GameState* gameState, PlayerInput *input) {
 }
 
 static void
-sdlHandleEvent(GameState* gameState, SDL_Event *event, PlayerInput *input) {
+metricsRecordGameEnd(GameEndStatus endStatus) {
+  metricsIncrement(METRIC_GAMES_FINISHED);
+  switch (endStatus) {
+    case DRAW_END: {
+      metricsIncrement(METRIC_OUTCOME_DRAW);
+    } break;
+
+    case COMPUTER_WINS_END: {
+      metricsIncrement(METRIC_OUTCOME_COMPUTER_WINS);
+    } break;
+
+    case PLAYER_WINS_END: {
+      metricsIncrement(METRIC_OUTCOME_PLAYER_WINS);
+    } break;
+
+    default:
+      assert(false);
+  }
+}
+
+/*
+ * Exports the metrics together with the analysis cache counters, which the
+ * cache keeps itself.
+ */
+static bool
+analysisCacheExportMetrics(char* path, AnalysisCache* analysisCache) {
+  AnalysisCacheStats stats = analysisCacheStats(analysisCache);
+  MetricSample samples[] = {
+    { { "tictactoe_analysis_cache_lookups_total", "result=\"hit\"", "Analysis cache lookups." },
+      "counter", stats.hits },
+    { { "tictactoe_analysis_cache_lookups_total", "result=\"miss\"", 0 }, 
+      "counter", stats.misses },
+    { { "tictactoe_analysis_cache_inserts_total", 0, "Analysis cache inserts." }, 
+      "counter", stats.inserts },
+    { { "tictactoe_analysis_cache_evictions_total", 0, "Analysis cache evictions." }, 
+      "counter", stats.evictions },
+    { { "tictactoe_analysis_cache_entries", 0, "Analysis cache live entries." }, 
+      "gauge", stats.entries },
+    { { "tictactoe_analysis_cache_memory_bytes", 0, "Analysis cache memory." }, 
+      "gauge", stats.memoryBytes },
+  };
+  return metricsExport(path, samples, (int) (sizeof(samples) / sizeof(samples[0])));
+}
+
+struct AnalysisWorker {
+  AnalysisCache* cache;
+  SDL_Thread* thread;
+  SDL_sem* wakeUp;
+  std::atomic<uint32_t> request; // ANALYSIS_IN_USE | key, 0 when idle
+  std::atomic<bool> quit;
+};
+
+/*
+ * Evaluates the requested position one tile at a time, so hints show up as
+ * soon as each tile is known, and drops the rest of the work as soon as a
+ * newer position is requested.
+ */
+static int
+analysisWorkerRun(void* data) {
+  AnalysisWorker* worker = (AnalysisWorker*) data;
+  for (;;) {
+    SDL_SemWait(worker->wakeUp);
+    if (worker->quit.load()) {
+      break;
+    }
+    uint32_t request = worker->request.exchange(0);
+    if (request == 0) {
+      continue;
+    }
+    uint32_t computerMask = request & BOARD_MASK;
+    uint32_t playerMask = (request >> 9) & BOARD_MASK;
+    bool computerToMove = gameComputerToMove(computerMask, playerMask);
+    for (int tileIndex = 0; tileIndex < 9 && worker->request.load() == 0; ++tileIndex) {
+      uint32_t tileBit = 1u << tileIndex;
+      if ((computerMask | playerMask) & tileBit) {
+        continue;
+      }
+      int bestTile;
+      if (computerToMove) {
+        analysisEvaluate(worker->cache, computerMask | tileBit, playerMask, &bestTile);
+      } else {
+        analysisEvaluate(worker->cache, computerMask, playerMask | tileBit, &bestTile);
+      }
+    }
+    if (worker->request.load() == 0) {
+      int bestTile;
+      analysisEvaluate(worker->cache, computerMask, playerMask, &bestTile);
+    }
+  }
+  return 0;
+}
 
-  printf("event->type: %x\n", event->type);
+static bool
+analysisWorkerStart(AnalysisWorker* worker, AnalysisCache* analysisCache) {
+  worker->cache = analysisCache;
+  worker->request.store(0);
+  worker->quit.store(false);
+  worker->wakeUp = SDL_CreateSemaphore(0);
+  if (worker->wakeUp == 0) {
+    fprintf(stderr, "SDL_CreateSemaphore Error: %s\n", SDL_GetError());
+    return false;
+  }
+  worker->thread = SDL_CreateThread(analysisWorkerRun, "analysis", worker);
+  if (worker->thread == 0) {
+    fprintf(stderr, "SDL_CreateThread Error: %s\n", SDL_GetError());
+    SDL_DestroySemaphore(worker->wakeUp);
+    worker->wakeUp = 0;
+    return false;
+  }
+  return true;
+}
+
+static void
+analysisWorkerStop(AnalysisWorker* worker) {
+  if (worker->thread == 0) {
+    return;
+  }
+  worker->quit.store(true);
+  SDL_SemPost(worker->wakeUp);
+  SDL_WaitThread(worker->thread, 0);
+  SDL_DestroySemaphore(worker->wakeUp);
+  worker->thread = 0;
+  worker->wakeUp = 0;
+}
+
+/*
+ * Never blocks: the newest request replaces any pending one.
+ */
+static void
+analysisWorkerRequest(AnalysisWorker* worker, GameState* gameState) {
+  if (worker->thread == 0 || gameState->endStatus != NO_END) {
+    return;
+  }
+  uint32_t computerMask;
+  uint32_t playerMask;
+  gameBoardMasks(gameState, &computerMask, &playerMask);
+  worker->request.store(ANALYSIS_IN_USE | analysisKey(computerMask, playerMask));
+  SDL_SemPost(worker->wakeUp);
+}
+
+static void
+sdlHandleEvent(GameState* gameState, SDL_Event *event, PlayerInput *input) {
 
   switch (event->type) {
 
@@ -526,6 +946,11 @@ sdlHandleEvent(GameState* gameState, SDL_Event *event, PlayerInput *input) {
           case SDLK_c: {
             input->keyPressed[2][2] = isDown;
           } break;
+          case SDLK_h: {
+            if (isDown) {
+              input->showHints = !input->showHints;
+            }
+          } break;
           case SDLK_ESCAPE: {
             gameState->running = isDown;
           } break;
@@ -574,18 +999,685 @@ sdlGameEnd(GameState* gameState, SDL_Window *win) {
     return 1;
   }
   if (buttonid == 1) {
-      *gameState = {};
-      gameState->freeTilesCount = 9;  
-      gameState->running = true;
-      gameState->endStatus = NO_END;
+      gameStateReset(gameState);
   } else {
       gameState->running = false;
   }
   return 0;
 }
 
+struct SpectatorBoard {
+  GameState gameState;
+  int moveFrame;
+  int restartFrames;
+  bool dirty;
+};
+
+struct Spectator {
+  SpectatorBoard* boards;
+  int boardCount;
+  int columns;
+  int tileSize;
+  SDL_Texture* canvas;
+  AnalysisCache* analysisCache;
+  int outcomes[4];
+};
+
+/*
+ * Swaps computer and player tiles so the computer heuristics can play the
+ * player side as well.
+ */
+static void
+gameStateMirror(GameState* gameState) {
+  for (int row = 0; row < 3; ++row) {
+    for (int column = 0; column < 3; ++column) {
+      switch (gameState->board[row][column]) {
+        case COMPUTER_TILE: {
+          gameState->board[row][column] = PLAYER_TILE;
+        } break;
+
+        case PLAYER_TILE: {
+          gameState->board[row][column] = COMPUTER_TILE;
+        } break;
+
+        default: {
+        }
+      }
+    }
+  }
+  switch (gameState->endStatus) {
+    case COMPUTER_WINS_END: {
+      gameState->endStatus = PLAYER_WINS_END;
+    } break;
+
+    case PLAYER_WINS_END: {
+      gameState->endStatus = COMPUTER_WINS_END;
+    } break;
+
+    default: {
+    }
+  }
+}
+
+/*
+ * Advances one board by a single move, or restarts it once its finished game
+ * has been on screen long enough. Boards move on different frames so only a
+ * fraction of them has to be redrawn on any frame.
+ */
+static void
+spectatorUpdateBoard(Spectator* spectator, SpectatorBoard* board, int frame) {
+  GameState* gameState = &board->gameState;
+  if (gameState->endStatus != NO_END) {
+    if (--board->restartFrames <= 0) {
+      gameStateReset(gameState);
+      metricsIncrement(METRIC_GAMES_STARTED);
+      board->dirty = true;
+    }
+    return;
+  }
+  if (frame % SPECTATOR_MOVE_FRAMES != board->moveFrame) {
+    return;
+  }
+  uint32_t computerMask;
+  uint32_t playerMask;
+  gameBoardMasks(gameState, &computerMask, &playerMask);
+  if (gameComputerToMove(computerMask, playerMask)) {
+    gameUpdateComputer(gameState, spectator->analysisCache);
+  } else {
+    // The player side plays the mirrored heuristics. Its decision times are
+    // not recorded, the AI decision histograms are the computer's alone.
+    gameStateMirror(gameState);
+    gameUpdateComputerMove(gameState, 0);
+    gameStateMirror(gameState);
+    metricsIncrement(METRIC_MOVES);
+    gameUpdateStatus(gameState);
+  }
+  board->dirty = true;
+  if (gameState->endStatus != NO_END) {
+    board->restartFrames = SPECTATOR_RESTART_FRAMES;
+    ++spectator->outcomes[gameState->endStatus];
+    metricsRecordGameEnd(gameState->endStatus);
+  }
+}
+
+static void
+sdlRenderSpectatorBoard(Spectator* spectator, int boardIndex, 
+                        SDL_Renderer *ren, SpriteSheet* spriteSheet) {
+  SpectatorBoard* board = &spectator->boards[boardIndex];
+  int boardSize = 3 * spectator->tileSize;
+  int left = (boardIndex % spectator->columns) * (boardSize + SPECTATOR_BOARD_GAP);
+  int top = (boardIndex / spectator->columns) * (boardSize + SPECTATOR_BOARD_GAP);
+  sdlRenderBoard(&board->gameState, ren, spriteSheet, left, top, spectator->tileSize);
+
+  if (board->gameState.endStatus != NO_END) {
+    switch (board->gameState.endStatus) {
+      case COMPUTER_WINS_END: {
+        SDL_SetRenderDrawColor(ren, 0xE0, 0x40, 0x40, 0x60);
+      } break;
+
+      case PLAYER_WINS_END: {
+        SDL_SetRenderDrawColor(ren, 0x40, 0x40, 0xE0, 0x60);
+      } break;
+
+      default: {
+        SDL_SetRenderDrawColor(ren, 0x80, 0x80, 0x80, 0x60);
+      }
+    }
+    SDL_Rect boardRect = {left, top, boardSize, boardSize};
+    SDL_SetRenderDrawBlendMode(ren, SDL_BLENDMODE_BLEND);
+    SDL_RenderFillRect(ren, &boardRect);
+    SDL_SetRenderDrawBlendMode(ren, SDL_BLENDMODE_NONE);
+  }
+  board->dirty = false;
+}
+
+/*
+ * Every board lives in a window sized canvas texture; a frame redraws only
+ * the boards that changed into it and then presents the whole canvas with a
+ * single copy.
+ */
+static void
+sdlRenderSpectator(Spectator* spectator, SDL_Renderer *ren, SpriteSheet* spriteSheet) {
+  SDL_SetRenderTarget(ren, spectator->canvas);
+  for (int boardIndex = 0; boardIndex < spectator->boardCount; ++boardIndex) {
+    if (spectator->boards[boardIndex].dirty) {
+      sdlRenderSpectatorBoard(spectator, boardIndex, ren, spriteSheet);
+    }
+  }
+  SDL_SetRenderTarget(ren, 0);
+  SDL_RenderCopy(ren, spectator->canvas, 0, 0);
+  SDL_RenderPresent(ren);
+}
+
+static void
+spectatorMarkAllDirty(Spectator* spectator) {
+  for (int boardIndex = 0; boardIndex < spectator->boardCount; ++boardIndex) {
+    spectator->boards[boardIndex].dirty = true;
+  }
+}
+
+/*
+ * Runs boardCount games side by side until the window is closed, the solved
+ * computer against the heuristics playing the player side; the window title
+ * keeps the measured frame rate and the running tally of outcomes. On exit
+ * the frame rate and frame work time are printed for the renderer in use.
+ */
+static int
+sdlRunSpectator(int boardCount, SDL_Window *win, SDL_Renderer *ren, SpriteSheet* spriteSheet,
+                AnalysisCache* analysisCache, char* metricsPath) {
+  Spectator spectator = {};
+  spectator.boardCount = boardCount;
+  spectator.analysisCache = analysisCache;
+  // Pick the column count that gives the biggest tiles.
+  for (int columns = 1; columns <= boardCount; ++columns) {
+    int rows = (boardCount + columns - 1) / columns;
+    int tileWidth = (SCREEN_WIDTH - (columns - 1) * SPECTATOR_BOARD_GAP) / (3 * columns);
+    int tileHeight = (SCREEN_HEIGHT - (rows - 1) * SPECTATOR_BOARD_GAP) / (3 * rows);
+    int tileSize = (tileWidth < tileHeight) ? tileWidth : tileHeight;
+    if (tileSize > spectator.tileSize) {
+      spectator.tileSize = tileSize;
+      spectator.columns = columns;
+    }
+  }
+  if (spectator.tileSize < 1) {
+    fprintf(stderr, "Too many boards to fit the window: %d\n", boardCount);
+    return 1;
+  }
+
+  spectator.boards = (SpectatorBoard*) calloc(boardCount, sizeof(SpectatorBoard));
+  if (!spectator.boards) {
+    fprintf(stderr,"malloc failed!\n");
+    return 1;
+  }
+  for (int boardIndex = 0; boardIndex < boardCount; ++boardIndex) {
+    SpectatorBoard* board = &spectator.boards[boardIndex];
+    gameStateReset(&board->gameState);
+    metricsIncrement(METRIC_GAMES_STARTED);
+    board->moveFrame = boardIndex % SPECTATOR_MOVE_FRAMES;
+    board->dirty = true;
+  }
+
+  spectator.canvas = SDL_CreateTexture(ren, SDL_PIXELFORMAT_RGBA8888, 
+                                       SDL_TEXTUREACCESS_TARGET, 
+                                       SCREEN_WIDTH, SCREEN_HEIGHT);
+  if (spectator.canvas == 0) {
+    fprintf(stderr, "SDL_CreateTexture Error: %s\n", SDL_GetError());
+    free(spectator.boards);
+    return 1;
+  }
+  SDL_SetRenderTarget(ren, spectator.canvas);
+  SDL_SetRenderDrawColor(ren, 0xFF, 0xFF, 0xFF, 0xFF);
+  SDL_RenderClear(ren);
+  SDL_SetRenderTarget(ren, 0);
+
+  bool running = true;
+  Uint32 titleTicks = SDL_GetTicks();
+  int titleFrame = 0;
+  Uint32 metricsTicks = titleTicks;
+  Uint64 runStart = SDL_GetPerformanceCounter();
+  Uint64 totalWork = 0;
+  Uint64 maxWork = 0;
+  int frame;
+  for (frame = 0; running; ++frame) {
+    Uint32 frameStartTicks = SDL_GetTicks();
+    Uint64 frameStart = SDL_GetPerformanceCounter();
+    SDL_Event event;
+    int eventCount = 0;
+    while (SDL_PollEvent(&event) > 0) {
+      ++eventCount;
+      switch (event.type) {
+        case SDL_QUIT: {
+          running = false;
+        } break;
+
+        case SDL_KEYDOWN: {
+          if (event.key.keysym.sym == SDLK_ESCAPE) {
+            running = false;
+          }
+        } break;
+
+        case SDL_RENDER_TARGETS_RESET: {
+          // The canvas contents are gone, draw every board again.
+          SDL_SetRenderTarget(ren, spectator.canvas);
+          SDL_SetRenderDrawColor(ren, 0xFF, 0xFF, 0xFF, 0xFF);
+          SDL_RenderClear(ren);
+          SDL_SetRenderTarget(ren, 0);
+          spectatorMarkAllDirty(&spectator);
+        } break;
+      }
+    }
+    metricsObserve(METRIC_EVENT_QUEUE_DEPTH, eventCount);
+
+    for (int boardIndex = 0; boardIndex < boardCount; ++boardIndex) {
+      spectatorUpdateBoard(&spectator, &spectator.boards[boardIndex], frame);
+    }
+    sdlRenderSpectator(&spectator, ren, spriteSheet);
+
+    if (frameStartTicks - titleTicks >= 1000) {
+      char title[200];
+      double fps = 1000.0 * (frame - titleFrame) / (frameStartTicks - titleTicks);
+      sprintf(title, "Tic Tac Toe - %d boards - %.1f fps - computer %d / player %d / draw %d", 
+              boardCount, fps, spectator.outcomes[COMPUTER_WINS_END], 
+              spectator.outcomes[PLAYER_WINS_END], spectator.outcomes[DRAW_END]);
+      SDL_SetWindowTitle(win, title);
+      titleTicks = frameStartTicks;
+      titleFrame = frame;
+    }
+    if (metricsPath && frameStartTicks - metricsTicks >= METRICS_EXPORT_MS) {
+      analysisCacheExportMetrics(metricsPath, analysisCache);
+      metricsTicks = frameStartTicks;
+    }
+
+    Uint64 work = SDL_GetPerformanceCounter() - frameStart;
+    totalWork += work;
+    if (work > maxWork) {
+      maxWork = work;
+    }
+    // Vsync is not available on every renderer, the software one included.
+    Uint32 frameTicks = SDL_GetTicks() - frameStartTicks;
+    if (frameTicks < SPECTATOR_FRAME_MS) {
+      SDL_Delay(SPECTATOR_FRAME_MS - frameTicks);
+    }
+    metricsObserve(METRIC_FRAME_TIME, 
+                   metricsTicksToNanos(SDL_GetPerformanceCounter() - frameStart));
+  }
+
+  double seconds = (double) (SDL_GetPerformanceCounter() - runStart) / 
+                   (double) SDL_GetPerformanceFrequency();
+  double millisPerTick = 1000.0 / (double) SDL_GetPerformanceFrequency();
+  SDL_RendererInfo rendererInfo;
+  if (SDL_GetRendererInfo(ren, &rendererInfo) != 0) {
+    rendererInfo.name = "unknown";
+  }
+  printf("spectate %d boards, %s renderer\n", boardCount, rendererInfo.name);
+  printf("frames:         %d\n", frame);
+  printf("fps:            %.1f\n", (seconds > 0.0) ? frame / seconds : 0.0);
+  printf("frame work:     %.3f ms average, %.3f ms max\n", 
+         (frame > 0) ? totalWork * millisPerTick / frame : 0.0, maxWork * millisPerTick);
+
+  if (metricsPath) {
+    analysisCacheExportMetrics(metricsPath, analysisCache);
+  }
+  SDL_DestroyTexture(spectator.canvas);
+  free(spectator.boards);
+  return 0;
+}
+
+struct PerftCounts {
+  uint64_t nodes;
+  uint64_t leaves;
+  uint64_t endings[4]; // indexed by GameEndStatus, NO_END unused
+};
+
+struct Perft {
+  GameState root;
+  TileValue rootToMove;
+  int depth;
+  int rootMoves[9];
+  int rootMoveCount;
+  std::atomic<int> nextRootMove;
+  bool hashed;
+  std::atomic<uint32_t> seenPositions[PERFT_POSITION_WORDS]; // one bit per position key
+  PerftCounts threadCounts[PERFT_MAX_THREADS];
+};
+
+struct PerftThread {
+  Perft* perft;
+  int threadIndex;
+};
+
+static void
+perftMarkSeen(Perft* perft, GameState* gameState) {
+  uint32_t computerMask;
+  uint32_t playerMask;
+  gameBoardMasks(gameState, &computerMask, &playerMask);
+  uint32_t key = analysisKey(computerMask, playerMask);
+  perft->seenPositions[key / 32].fetch_or(1u << (key % 32), std::memory_order_relaxed);
+}
+
+static void perftWalk(Perft* perft, GameState* gameState, TileValue tileValue, 
+                      int depth, PerftCounts* counts);
+
+/*
+ * Plays one move with the same code the game itself uses, then keeps walking
+ * below it unless the game ended or depth ran out.
+ */
+static void
+perftVisit(Perft* perft, GameState* gameState, int row, int column, 
+           TileValue tileValue, int depth, PerftCounts* counts) {
+  GameState child = *gameState;
+  gameApplyMove(&child, row, column, tileValue);
+  gameUpdateStatus(&child);
+  ++counts->nodes;
+  if (perft->hashed) {
+    perftMarkSeen(perft, &child);
+  }
+  if (child.endStatus != NO_END) {
+    ++counts->endings[child.endStatus];
+    ++counts->leaves;
+  } else if (depth > 1) {
+    TileValue nextTileValue = (tileValue == PLAYER_TILE) ? COMPUTER_TILE : PLAYER_TILE;
+    perftWalk(perft, &child, nextTileValue, depth - 1, counts);
+  } else {
+    ++counts->leaves;
+  }
+}
+
+static void
+perftWalk(Perft* perft, GameState* gameState, TileValue tileValue, 
+          int depth, PerftCounts* counts) {
+  for (int row = 0; row < 3; ++row) {
+    for (int column = 0; column < 3; ++column) {
+      if (gameState->board[row][column] == EMPTY_TILE) {
+        perftVisit(perft, gameState, row, column, tileValue, depth, counts);
+      }
+    }
+  }
+}
+
+static int
+perftThreadRun(void* data) {
+  PerftThread* perftThread = (PerftThread*) data;
+  Perft* perft = perftThread->perft;
+  // Counted locally and stored once: neighbouring threadCounts slots share
+  // cache lines, so updating them in place would bounce those lines between
+  // the threads on every node.
+  PerftCounts counts = {};
+  for (;;) {
+    int moveIndex = perft->nextRootMove.fetch_add(1);
+    if (moveIndex >= perft->rootMoveCount) {
+      break;
+    }
+    int tileIndex = perft->rootMoves[moveIndex];
+    perftVisit(perft, &perft->root, tileIndex / 3, tileIndex % 3, 
+               perft->rootToMove, perft->depth, &counts);
+  }
+  perft->threadCounts[perftThread->threadIndex] = counts;
+  return 0;
+}
+
+/*
+ * Parses a position as nine tiles, row by row: 'c' computer, 'p' player and
+ * '.' empty. The side to move follows from the tile counts.
+ */
+static bool
+perftParsePosition(char* text, GameState* gameState, TileValue* toMove) {
+  gameStateReset(gameState);
+  if (strlen(text) != 9) {
+    return false;
+  }
+  for (int tileIndex = 0; tileIndex < 9; ++tileIndex) {
+    switch (text[tileIndex]) {
+      case 'c': {
+        gameApplyMove(gameState, tileIndex / 3, tileIndex % 3, COMPUTER_TILE);
+      } break;
+
+      case 'p': {
+        gameApplyMove(gameState, tileIndex / 3, tileIndex % 3, PLAYER_TILE);
+      } break;
+
+      case '.': {
+      } break;
+
+      default:
+        return false;
+    }
+  }
+  uint32_t computerMask;
+  uint32_t playerMask;
+  gameBoardMasks(gameState, &computerMask, &playerMask);
+  int computerTiles = countBits(computerMask);
+  int playerTiles = countBits(playerMask);
+  if (playerTiles != computerTiles && playerTiles != computerTiles + 1) {
+    return false;
+  }
+  *toMove = gameComputerToMove(computerMask, playerMask) ? COMPUTER_TILE : PLAYER_TILE;
+  gameUpdateStatus(gameState);
+  return gameState->endStatus == NO_END;
+}
+
+/*
+ * Walks the whole game tree below a position to the given depth, splitting
+ * the root moves across threads, and reports node counts, finished games by
+ * end status and nodes per second. From the empty board at depth 9 there are
+ * 549,945 nodes and 255,168 games: 131,184 won by the side that opens,
+ * 77,904 by the other and 46,080 drawn; hashed mode sees 5,478 distinct
+ * positions including the root.
+ */
+static int
+runPerft(int depth, char* positionText, int threadCount, bool hashed) {
+  static Perft perft;
+  if (!perftParsePosition(positionText, &perft.root, &perft.rootToMove)) {
+    fprintf(stderr, "Invalid perft position: %s\n", positionText);
+    return 1;
+  }
+  if (depth < 1) {
+    fprintf(stderr, "Invalid perft depth: %d\n", depth);
+    return 1;
+  }
+  if (threadCount < 1) {
+    threadCount = 1;
+  }
+  if (threadCount > PERFT_MAX_THREADS) {
+    threadCount = PERFT_MAX_THREADS;
+  }
+  perft.depth = depth;
+  perft.rootMoveCount = 0;
+  for (int tileIndex = 0; tileIndex < 9; ++tileIndex) {
+    if (perft.root.board[tileIndex / 3][tileIndex % 3] == EMPTY_TILE) {
+      perft.rootMoves[perft.rootMoveCount++] = tileIndex;
+    }
+  }
+  perft.nextRootMove.store(0);
+  perft.hashed = hashed;
+  if (hashed) {
+    for (int word = 0; word < PERFT_POSITION_WORDS; ++word) {
+      perft.seenPositions[word].store(0, std::memory_order_relaxed);
+    }
+    perftMarkSeen(&perft, &perft.root);
+  }
+
+  Uint64 start = SDL_GetPerformanceCounter();
+  SDL_Thread* threads[PERFT_MAX_THREADS] = {};
+  PerftThread perftThreads[PERFT_MAX_THREADS];
+  for (int threadIndex = 0; threadIndex < threadCount; ++threadIndex) {
+    perft.threadCounts[threadIndex] = {};
+    perftThreads[threadIndex].perft = &perft;
+    perftThreads[threadIndex].threadIndex = threadIndex;
+    if (threadIndex > 0) {
+      threads[threadIndex] = SDL_CreateThread(perftThreadRun, "perft", 
+                                              &perftThreads[threadIndex]);
+      if (threads[threadIndex] == 0) {
+        fprintf(stderr, "SDL_CreateThread Error: %s\n", SDL_GetError());
+      }
+    }
+  }
+  // The calling thread works too, and picks up whatever failed threads left.
+  perftThreadRun(&perftThreads[0]);
+  for (int threadIndex = 1; threadIndex < threadCount; ++threadIndex) {
+    if (threads[threadIndex]) {
+      SDL_WaitThread(threads[threadIndex], 0);
+    }
+  }
+  Uint64 end = SDL_GetPerformanceCounter();
+
+  PerftCounts total = {};
+  for (int threadIndex = 0; threadIndex < threadCount; ++threadIndex) {
+    PerftCounts* counts = &perft.threadCounts[threadIndex];
+    total.nodes += counts->nodes;
+    total.leaves += counts->leaves;
+    for (int endStatus = 0; endStatus < 4; ++endStatus) {
+      total.endings[endStatus] += counts->endings[endStatus];
+    }
+  }
+  double seconds = (double) (end - start) / (double) SDL_GetPerformanceFrequency();
+
+  printf("perft %s depth %d, %d threads\n", positionText, depth, threadCount);
+  printf("nodes:          %llu\n", (unsigned long long) total.nodes);
+  printf("leaves:         %llu\n", (unsigned long long) total.leaves);
+  printf("games:          %llu\n", (unsigned long long) (total.endings[DRAW_END] + 
+                                                       total.endings[COMPUTER_WINS_END] + 
+                                                       total.endings[PLAYER_WINS_END]));
+  printf("  draw:         %llu\n", (unsigned long long) total.endings[DRAW_END]);
+  printf("  computer:     %llu\n", (unsigned long long) total.endings[COMPUTER_WINS_END]);
+  printf("  player:       %llu\n", (unsigned long long) total.endings[PLAYER_WINS_END]);
+  if (hashed) {
+    uint64_t uniquePositions = 0;
+    for (int word = 0; word < PERFT_POSITION_WORDS; ++word) {
+      uniquePositions += countBits(perft.seenPositions[word].load(std::memory_order_relaxed));
+    }
+    printf("unique:         %llu\n", (unsigned long long) uniquePositions);
+  }
+  printf("time:           %.3f ms\n", seconds * 1000.0);
+  printf("nodes/sec:      %.0f\n", (seconds > 0.0) ? total.nodes / seconds : 0.0);
+  return 0;
+}
+
+#if BUILD_INTERNAL
+/*
+ * Asks the OS to drop the cached pages of path so the next open reads it
+ * from disk, as after a restart. Best effort: returns false when the pages
+ * could not be dropped. Windows and macOS have no call to evict the cached
+ * pages of a single file, so the file stays warm there.
+ */
+static bool
+benchDropPageCache(char* path) {
+#if defined(BUILD_WIN32) || defined(BUILD_OSX)
+  return false;
+#else
+  int file = open(path, O_RDONLY);
+  if (file < 0) {
+    perror("open");
+    return false;
+  }
+  bool dropped = (fdatasync(file) == 0 &&
+                  posix_fadvise(file, 0, 0, POSIX_FADV_DONTNEED) == 0);
+  close(file);
+  return dropped;
+#endif
+}
+
+/*
+ * Measures how long it takes to get recordCount sessions back from a store
+ * file: mapping it and unpacking every record into a GameState.
+ *
+ * The store is filled first and its pages dropped from the OS cache before
+ * reopening. With reopen the file is left as it is, so the store can be
+ * filled by one run and recovered by another after a reboot; the file must
+ * then already hold recordCount sessions, it is never reinitialized.
+ */
+static int
+benchSessionStore(char* path, uint32_t recordCount, bool reopen) {
+  SessionStore sessionStore;
+  char* cacheState = (char*) "existing file, page cache not dropped";
+  if (reopen) {
+    uint32_t fileRecordCount;
+    if (!sessionStoreReadRecordCount(path, &fileRecordCount)) {
+      fprintf(stderr, "Not a session store: %s\n", path);
+      return 1;
+    }
+    if (fileRecordCount != recordCount) {
+      fprintf(stderr, "%s holds %u sessions, not %u\n", path, fileRecordCount, recordCount);
+      return 1;
+    }
+  } else {
+    if (!sessionStoreOpen(&sessionStore, path, recordCount)) {
+      return 1;
+    }
+    uint32_t seed = 0x9E3779B9;
+    for (uint32_t index = 0; index < recordCount; ++index) {
+      seed = seed * 1664525 + 1013904223;
+      uint32_t computerMask = (seed >> 8) & SESSION_RECORD_MASK_BITS;
+      uint32_t playerMask = (seed >> 20) & ~computerMask & SESSION_RECORD_MASK_BITS;
+      sessionStoreSave(&sessionStore, index, 
+                       sessionRecordPack(computerMask, playerMask, 0, NO_END));
+    }
+    sessionStoreClose(&sessionStore);
+    cacheState = benchDropPageCache(path) 
+               ? (char*) "page cache dropped" 
+               : (char*) "page cache warm, could not drop it";
+  }
+
+  Uint64 start = SDL_GetPerformanceCounter();
+  if (!sessionStoreOpen(&sessionStore, path, recordCount)) {
+    return 1;
+  }
+  Uint64 mapped = SDL_GetPerformanceCounter();
+  int64_t freeTiles = 0;
+  uint32_t inUse = 0;
+  for (uint32_t index = 0; index < recordCount; ++index) {
+    uint32_t record = sessionStoreLoad(&sessionStore, index);
+    GameState gameState;
+    gameStateUnpack(&gameState, record);
+    freeTiles += gameState.freeTilesCount;
+    inUse += sessionRecordInUse(record);
+  }
+  Uint64 end = SDL_GetPerformanceCounter();
+  sessionStoreClose(&sessionStore);
+
+  double frequency = (double) SDL_GetPerformanceFrequency();
+  printf("sessions: %u, %u in use (checksum %lld)\n", 
+         recordCount, inUse, (long long) freeTiles);
+  printf("cache:    %s\n", cacheState);
+  printf("open:     %.3f ms\n", 1000.0 * (mapped - start) / frequency);
+  printf("recover:  %.3f ms\n", 1000.0 * (end - start) / frequency);
+  return 0;
+}
+
+#endif
+
+// Tools that include this file, like trap_check.cpp, bring their own main.
+#if !BUILD_TOOL
 int 
-main(int, char**) {
+main(int argc, char** argv) {
+#if BUILD_INTERNAL
+  if (argc >= 3 && strcmp(argv[1], "--bench-store") == 0) {
+    char* path = (char*) "sessions-bench.dat";
+    bool reopen = false;
+    for (int argIndex = 3; argIndex < argc; ++argIndex) {
+      if (strcmp(argv[argIndex], "--reopen") == 0) {
+        reopen = true;
+      } else {
+        path = argv[argIndex];
+      }
+    }
+    return benchSessionStore(path, (uint32_t) strtoul(argv[2], 0, 10), reopen);
+  }
+#endif
+  if (argc >= 3 && strcmp(argv[1], "--perft") == 0) {
+    int depth = atoi(argv[2]);
+    char* position = (char*) ".........";
+    int threadCount = SDL_GetCPUCount();
+    bool hashed = false;
+    for (int argIndex = 3; argIndex < argc; ++argIndex) {
+      if (strcmp(argv[argIndex], "--hashed") == 0) {
+        hashed = true;
+      } else if (strcmp(argv[argIndex], "--threads") == 0 && argIndex + 1 < argc) {
+        threadCount = atoi(argv[++argIndex]);
+      } else {
+        position = argv[argIndex];
+      }
+    }
+    return runPerft(depth, position, threadCount, hashed);
+  }
+
+  int spectatorBoardCount = 0;
+  bool softwareRenderer = false;
+  if (argc >= 2 && strcmp(argv[1], "--spectate") == 0) {
+    spectatorBoardCount = SPECTATOR_DEFAULT_BOARDS;
+    for (int argIndex = 2; argIndex < argc; ++argIndex) {
+      if (strcmp(argv[argIndex], "--software") == 0) {
+        softwareRenderer = true;
+      } else {
+        spectatorBoardCount = atoi(argv[argIndex]);
+        if (spectatorBoardCount <= 0) {
+          fprintf(stderr, "Invalid board count: %s\n", argv[argIndex]);
+          return 1;
+        }
+      }
+    }
+  }
+
   if (SDL_Init(SDL_INIT_EVERYTHING) != 0) {
     fprintf(stderr, "SDL_Init Error: %s\n", SDL_GetError());
     return 1;
@@ -607,8 +1699,14 @@ main(int, char**) {
     return 1;
   }
 
-  SDL_Renderer *ren = SDL_CreateRenderer(win, -1, SDL_RENDERER_ACCELERATED | 
-                                         SDL_RENDERER_PRESENTVSYNC);
+  Uint32 rendererFlags = SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC;
+  if (spectatorBoardCount) {
+    rendererFlags = SDL_RENDERER_TARGETTEXTURE;
+    if (softwareRenderer) {
+      rendererFlags |= SDL_RENDERER_SOFTWARE;
+    }
+  }
+  SDL_Renderer *ren = SDL_CreateRenderer(win, -1, rendererFlags);
   if (ren == 0) {
     SDL_DestroyWindow(win);
     fprintf(stderr, "SDL_CreateRenderer Error: %s\n", SDL_GetError());
@@ -658,32 +1756,102 @@ main(int, char**) {
 #else
   srandom(time(0));
 #endif
-  GameState gameState = {};
-  gameState.freeTilesCount = 9;  
-  gameState.running = true;
-  gameState.endStatus = NO_END;
+
+  char* metricsPath = sdlGetPrefFilePath(METRICS_FILENAME);
+  static AnalysisCache analysisCache;
+  analysisCacheInit(&analysisCache);
+  if (spectatorBoardCount) {
+    return sdlRunSpectator(spectatorBoardCount, win, ren, &spriteSheet, &analysisCache, 
+                           metricsPath);
+  }
+  static AnalysisWorker analysisWorker;
+  if (!analysisWorkerStart(&analysisWorker, &analysisCache)) {
+    fprintf(stderr, "analysisWorkerStart Error: hints disabled\n");
+  }
+
+  SessionStore sessionStore = {};
+  char* storePath = sdlGetPrefFilePath(SESSION_STORE_FILENAME);
+  if (storePath) {
+    if (!sessionStoreOpen(&sessionStore, storePath, SESSION_STORE_RECORD_COUNT)) {
+      fprintf(stderr, "sessionStoreOpen Error: %s\n", storePath);
+    }
+    free(storePath);
+  }
+
+  GameState gameState;
+  gameStateReset(&gameState);
+  bool restored = false;
+  if (sessionStore.header) {
+    uint32_t record = sessionStoreLoad(&sessionStore, 0);
+    if (sessionRecordInUse(record) && sessionRecordEndStatus(record) == NO_END) {
+      gameStateUnpack(&gameState, record);
+      restored = true;
+      if (sessionRecordComputerToMove(record)) {
+        gameUpdateComputer(&gameState, &analysisCache);
+        gameStateSave(&gameState, &sessionStore);
+      }
+    }
+  }
+  if (!restored) {
+    metricsIncrement(METRIC_GAMES_STARTED);
+  }
+  analysisWorkerRequest(&analysisWorker, &gameState);
     
   PlayerInput input = {};
 
+  Uint32 metricsTicks = SDL_GetTicks();
   while (gameState.running) {
+    Uint64 frameStart = SDL_GetPerformanceCounter();
     SDL_Event event;
+    int eventCount = 0;
     while (SDL_PollEvent(&event) > 0) {
+      ++eventCount;
       sdlHandleEvent(&gameState, &event, &input);
     }
+    metricsObserve(METRIC_EVENT_QUEUE_DEPTH, eventCount);
     if (gameState.running) {
-      if (gameUpdatePlayer(&gameState, &input) && 
-          gameState.endStatus == NO_END) {
-        gameUpdateComputer(&gameState);
+      if (gameUpdatePlayer(&gameState, &input)) {
+        // Saved before the computer replies too, so a restart in between
+        // resumes with the computer to move.
+        gameStateSave(&gameState, &sessionStore);
+        if (gameState.endStatus == NO_END) {
+          gameUpdateComputer(&gameState, &analysisCache);
+          gameStateSave(&gameState, &sessionStore);
+        }
+        analysisWorkerRequest(&analysisWorker, &gameState);
       }
     
-      sdlRenderGame(&gameState, ren, &spriteSheet);
+      sdlRenderGame(&gameState, ren, &spriteSheet, &analysisCache, input.showHints);
+      // Taken before the game over dialog, which waits on the user.
+      metricsObserve(METRIC_FRAME_TIME, 
+                     metricsTicksToNanos(SDL_GetPerformanceCounter() - frameStart));
       
       if (gameState.endStatus != NO_END) {
+        metricsRecordGameEnd(gameState.endStatus);
         if (sdlGameEnd(&gameState, win)) {
           return 1;
         }
+        if (gameState.running) {
+          metricsIncrement(METRIC_GAMES_STARTED);
+        }
+        gameStateSave(&gameState, &sessionStore);
+        sessionStoreFlush(&sessionStore);
+        analysisWorkerRequest(&analysisWorker, &gameState);
       }
     }
+
+    Uint32 ticks = SDL_GetTicks();
+    if (metricsPath && ticks - metricsTicks >= METRICS_EXPORT_MS) {
+      analysisCacheExportMetrics(metricsPath, &analysisCache);
+      metricsTicks = ticks;
+    }
+  }
+  analysisWorkerStop(&analysisWorker);
+  sessionStoreClose(&sessionStore);
+  if (metricsPath) {
+    analysisCacheExportMetrics(metricsPath, &analysisCache);
+    free(metricsPath);
   }
   return 0;
-}
\ No newline at end of file
+}
+#endif
@@ -0,0 +1,321 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <atomic>
+#ifdef BUILD_OSX
+#include <SDL2/SDL.h>
+#else
+#include <SDL.h>
+#endif
+
+#ifdef BUILD_WIN32
+#include <windows.h>
+#endif
+
+/*
+ * Runtime counters and histograms.
+ *
+ * Every thread records into its own slot, so updates are uncontended
+ * relaxed atomic adds; the exporter sums all slots when it writes them out
+ * in the Prometheus text exposition format. Threads past METRICS_MAX_THREADS
+ * share the last slot, which stays correct because the adds are atomic.
+ */
+
+#define METRICS_MAX_THREADS 64
+#define METRICS_MAX_BUCKETS 16
+#define METRICS_FILENAME "metrics.prom"
+#define METRICS_EXPORT_MS 5000
+
+enum MetricCounter {
+  METRIC_GAMES_STARTED = 0,
+  METRIC_GAMES_FINISHED,
+  METRIC_OUTCOME_DRAW,
+  METRIC_OUTCOME_COMPUTER_WINS,
+  METRIC_OUTCOME_PLAYER_WINS,
+  METRIC_MOVES,
+  METRIC_COUNTER_COUNT
+};
+
+enum MetricHistogram {
+  METRIC_AI_DECISION_CACHE = 0,
+  METRIC_AI_DECISION_LINE,
+  METRIC_AI_DECISION_TRAP,
+  METRIC_AI_DECISION_CORNER,
+  METRIC_AI_DECISION_RANDOM,
+  METRIC_FRAME_TIME,
+  METRIC_EVENT_QUEUE_DEPTH,
+  METRIC_HISTOGRAM_COUNT
+};
+
+struct MetricDescription {
+  char* name;
+  char* labels;
+  char* help;
+};
+
+// Values kept outside the metrics slots, like another module's own
+// counters, handed to metricsExport ready to write.
+struct MetricSample {
+  MetricDescription description;
+  char* type;
+  uint64_t value;
+};
+
+static MetricDescription METRIC_COUNTERS[METRIC_COUNTER_COUNT] = {
+  { "tictactoe_games_started_total", 0, "Games started." },
+  { "tictactoe_games_finished_total", 0, "Games finished." },
+  { "tictactoe_game_outcomes_total", "outcome=\"draw\"", "Finished games by end status." },
+  { "tictactoe_game_outcomes_total", "outcome=\"computer_wins\"", 0 },
+  { "tictactoe_game_outcomes_total", "outcome=\"player_wins\"", 0 },
+  { "tictactoe_moves_total", 0, "Tiles placed by either side." },
+};
+
+// Histograms are recorded in nanoseconds (or plain units) and exported
+// divided by their scale.
+static MetricDescription METRIC_HISTOGRAMS[METRIC_HISTOGRAM_COUNT] = {
+  { "tictactoe_ai_decision_seconds", "stage=\"cache\"", "Computer move time by the heuristic stage that decided it." },
+  { "tictactoe_ai_decision_seconds", "stage=\"line\"", 0 },
+  { "tictactoe_ai_decision_seconds", "stage=\"trap\"", 0 },
+  { "tictactoe_ai_decision_seconds", "stage=\"corner\"", 0 },
+  { "tictactoe_ai_decision_seconds", "stage=\"random\"", 0 },
+  { "tictactoe_frame_seconds", 0, "Main loop frame time." },
+  { "tictactoe_event_queue_depth", 0, "SDL events drained per frame." },
+};
+
+static const uint64_t METRIC_NANOSECOND_BOUNDS[] = {
+  100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000, 
+  250000, 500000, 1000000, 5000000, 16666667, 50000000
+};
+
+static const uint64_t METRIC_DEPTH_BOUNDS[] = {
+  0, 1, 2, 4, 8, 16, 32, 64, 128
+};
+
+struct MetricsHistogramData {
+  std::atomic<uint64_t> buckets[METRICS_MAX_BUCKETS + 1]; // last one is +Inf
+  std::atomic<uint64_t> sum;
+};
+
+struct MetricsSlot {
+  std::atomic<uint64_t> counters[METRIC_COUNTER_COUNT];
+  MetricsHistogramData histograms[METRIC_HISTOGRAM_COUNT];
+};
+
+struct Metrics {
+  MetricsSlot slots[METRICS_MAX_THREADS];
+  std::atomic<int> slotCount;
+  uint64_t lastExportMoves;
+  uint64_t lastExportCounter;
+};
+
+// Zero initialized as a global, which is all the slots need.
+static Metrics globalMetrics;
+static thread_local MetricsSlot* metricsThreadSlot;
+
+static MetricsSlot*
+metricsSlot() {
+  if (metricsThreadSlot == 0) {
+    int slotIndex = globalMetrics.slotCount.fetch_add(1, std::memory_order_relaxed);
+    if (slotIndex >= METRICS_MAX_THREADS) {
+      slotIndex = METRICS_MAX_THREADS - 1;
+    }
+    metricsThreadSlot = &globalMetrics.slots[slotIndex];
+  }
+  return metricsThreadSlot;
+}
+
+static void
+metricsHistogramBounds(MetricHistogram histogram, const uint64_t** bounds, int* boundCount) {
+  if (histogram == METRIC_EVENT_QUEUE_DEPTH) {
+    *bounds = METRIC_DEPTH_BOUNDS;
+    *boundCount = (int) (sizeof(METRIC_DEPTH_BOUNDS) / sizeof(METRIC_DEPTH_BOUNDS[0]));
+  } else {
+    *bounds = METRIC_NANOSECOND_BOUNDS;
+    *boundCount = (int) (sizeof(METRIC_NANOSECOND_BOUNDS) / sizeof(METRIC_NANOSECOND_BOUNDS[0]));
+  }
+  assert(*boundCount <= METRICS_MAX_BUCKETS);
+}
+
+static double
+metricsHistogramScale(MetricHistogram histogram) {
+  return (histogram == METRIC_EVENT_QUEUE_DEPTH) ? 1.0 : 1000000000.0;
+}
+
+static void
+metricsIncrement(MetricCounter counter, uint64_t amount = 1) {
+  metricsSlot()->counters[counter].fetch_add(amount, std::memory_order_relaxed);
+}
+
+static void
+metricsObserve(MetricHistogram histogram, uint64_t value) {
+  const uint64_t* bounds;
+  int boundCount;
+  metricsHistogramBounds(histogram, &bounds, &boundCount);
+  int bucket = 0;
+  while (bucket < boundCount && value > bounds[bucket]) {
+    ++bucket;
+  }
+  MetricsHistogramData* data = &metricsSlot()->histograms[histogram];
+  data->buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+  data->sum.fetch_add(value, std::memory_order_relaxed);
+}
+
+static uint64_t
+metricsTicksToNanos(uint64_t ticks) {
+  static double nanosPerTick = 1000000000.0 / (double) SDL_GetPerformanceFrequency();
+  return (uint64_t) ((double) ticks * nanosPerTick);
+}
+
+static uint64_t
+metricsCounterTotal(MetricCounter counter) {
+  int slotCount = globalMetrics.slotCount.load(std::memory_order_relaxed);
+  if (slotCount > METRICS_MAX_THREADS) {
+    slotCount = METRICS_MAX_THREADS;
+  }
+  uint64_t total = 0;
+  for (int slotIndex = 0; slotIndex < slotCount; ++slotIndex) {
+    total += globalMetrics.slots[slotIndex].counters[counter].load(std::memory_order_relaxed);
+  }
+  return total;
+}
+
+static void
+metricsWriteHeader(FILE* file, MetricDescription* description, char* type) {
+  if (description->help) {
+    fprintf(file, "# HELP %s %s\n", description->name, description->help);
+    fprintf(file, "# TYPE %s %s\n", description->name, type);
+  }
+}
+
+static void
+metricsWriteValue(FILE* file, MetricDescription* description, char* type, uint64_t value) {
+  metricsWriteHeader(file, description, type);
+  if (description->labels) {
+    fprintf(file, "%s{%s} %llu\n", description->name, description->labels, 
+            (unsigned long long) value);
+  } else {
+    fprintf(file, "%s %llu\n", description->name, (unsigned long long) value);
+  }
+}
+
+static void
+metricsWriteHistogram(FILE* file, MetricHistogram histogram) {
+  MetricDescription* description = &METRIC_HISTOGRAMS[histogram];
+  const uint64_t* bounds;
+  int boundCount;
+  metricsHistogramBounds(histogram, &bounds, &boundCount);
+  double scale = metricsHistogramScale(histogram);
+
+  int slotCount = globalMetrics.slotCount.load(std::memory_order_relaxed);
+  if (slotCount > METRICS_MAX_THREADS) {
+    slotCount = METRICS_MAX_THREADS;
+  }
+  uint64_t buckets[METRICS_MAX_BUCKETS + 1] = {};
+  uint64_t sum = 0;
+  for (int slotIndex = 0; slotIndex < slotCount; ++slotIndex) {
+    MetricsHistogramData* data = &globalMetrics.slots[slotIndex].histograms[histogram];
+    for (int bucket = 0; bucket <= boundCount; ++bucket) {
+      buckets[bucket] += data->buckets[bucket].load(std::memory_order_relaxed);
+    }
+    sum += data->sum.load(std::memory_order_relaxed);
+  }
+
+  char* labels = description->labels ? description->labels : (char*) "";
+  char* separator = description->labels ? (char*) "," : (char*) "";
+  metricsWriteHeader(file, description, "histogram");
+  uint64_t cumulative = 0;
+  for (int bucket = 0; bucket < boundCount; ++bucket) {
+    cumulative += buckets[bucket];
+    fprintf(file, "%s_bucket{%s%sle=\"%g\"} %llu\n", description->name, labels, separator,
+            bounds[bucket] / scale, (unsigned long long) cumulative);
+  }
+  // Slots are read while other threads keep recording, so the count comes
+  // from the buckets to keep +Inf and _count consistent.
+  cumulative += buckets[boundCount];
+  fprintf(file, "%s_bucket{%s%sle=\"+Inf\"} %llu\n", description->name, labels, separator,
+          (unsigned long long) cumulative);
+  if (description->labels) {
+    fprintf(file, "%s_sum{%s} %.9g\n", description->name, labels, sum / scale);
+    fprintf(file, "%s_count{%s} %llu\n", description->name, labels, (unsigned long long) cumulative);
+  } else {
+    fprintf(file, "%s_sum %.9g\n", description->name, sum / scale);
+    fprintf(file, "%s_count %llu\n", description->name, (unsigned long long) cumulative);
+  }
+}
+
+static void
+metricsWrite(FILE* file, MetricSample* samples, int sampleCount) {
+  for (int counter = 0; counter < METRIC_COUNTER_COUNT; ++counter) {
+    metricsWriteValue(file, &METRIC_COUNTERS[counter], "counter",
+                      metricsCounterTotal((MetricCounter) counter));
+  }
+
+  // Moves per second over the last export interval.
+  uint64_t moves = metricsCounterTotal(METRIC_MOVES);
+  uint64_t now = SDL_GetPerformanceCounter();
+  double movesPerSecond = 0.0;
+  if (globalMetrics.lastExportCounter) {
+    double seconds = (double) (now - globalMetrics.lastExportCounter) /
+                     (double) SDL_GetPerformanceFrequency();
+    if (seconds > 0.0) {
+      movesPerSecond = (double) (moves - globalMetrics.lastExportMoves) / seconds;
+    }
+  }
+  globalMetrics.lastExportMoves = moves;
+  globalMetrics.lastExportCounter = now;
+  fprintf(file, "# HELP tictactoe_moves_per_second Moves per second since the previous export.\n");
+  fprintf(file, "# TYPE tictactoe_moves_per_second gauge\n");
+  fprintf(file, "tictactoe_moves_per_second %g\n", movesPerSecond);
+
+  for (int histogram = 0; histogram < METRIC_HISTOGRAM_COUNT; ++histogram) {
+    metricsWriteHistogram(file, (MetricHistogram) histogram);
+  }
+
+  for (int sampleIndex = 0; sampleIndex < sampleCount; ++sampleIndex) {
+    MetricSample* sample = &samples[sampleIndex];
+    metricsWriteValue(file, &sample->description, sample->type, sample->value);
+  }
+}
+
+/*
+ * Writes the metrics, followed by samples, next to path and renames them
+ * over it, so a scraper never reads a half written file.
+ */
+static bool
+metricsExport(char* path, MetricSample* samples, int sampleCount) {
+  char tempPath[1024];
+  if (strlen(path) + strlen(".tmp") + 1 > sizeof(tempPath)) {
+    fprintf(stderr, "metrics path too long: %s\n", path);
+    return false;
+  }
+  strcpy(tempPath, path);
+  strcat(tempPath, ".tmp");
+  FILE* file = fopen(tempPath, "w");
+  if (!file) {
+    perror("fopen");
+    return false;
+  }
+  metricsWrite(file, samples, sampleCount);
+  if (fclose(file) != 0) {
+    perror("fclose");
+    return false;
+  }
+#ifdef BUILD_WIN32
+  if (!MoveFileExA(tempPath, path, MOVEFILE_REPLACE_EXISTING)) {
+    fprintf(stderr, "MoveFileEx Error: %lu\n", GetLastError());
+    return false;
+  }
+#else
+  if (rename(tempPath, path) != 0) {
+    perror("rename");
+    return false;
+  }
+#endif
+  return true;
+}
+
+#endif
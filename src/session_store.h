@@ -0,0 +1,284 @@
+#ifndef SESSION_STORE_H
+#define SESSION_STORE_H
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifdef BUILD_WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/*
+ * Fixed-record session store backed by a memory-mapped file.
+ *
+ * File layout:
+ *   SessionStoreHeader
+ *   uint32_t records[recordCount]
+ *
+ * Every session is packed in a single 32 bit record so that saving it is one
+ * aligned store into the mapping: a crash can never leave a torn record
+ * behind, and recovery is just mapping the file again, no parsing needed.
+ *
+ * Record bits:
+ *    0.. 8  computer tiles mask (bit = row * 3 + column)
+ *    9..17  player tiles mask
+ *   18      side to move (0 = player, 1 = computer)
+ *   19..20  end status
+ *   31      record in use
+ */
+
+#define SESSION_STORE_MAGIC 0x53545454 // "TTTS"
+#define SESSION_STORE_VERSION 1
+
+#define SESSION_RECORD_MASK_BITS 0x1FF
+#define SESSION_RECORD_PLAYER_SHIFT 9
+#define SESSION_RECORD_SIDE_SHIFT 18
+#define SESSION_RECORD_STATUS_SHIFT 19
+#define SESSION_RECORD_IN_USE 0x80000000u
+
+struct SessionStoreHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t recordCount;
+  uint32_t reserved;
+};
+
+struct SessionStore {
+  SessionStoreHeader* header;
+  volatile uint32_t* records;
+  uint32_t recordCount;
+  size_t mappingSize;
+#ifdef BUILD_WIN32
+  HANDLE file;
+  HANDLE mapping;
+#else
+  int file;
+#endif
+};
+
+static uint32_t
+sessionRecordPack(uint32_t computerMask, uint32_t playerMask,
+                  uint32_t computerToMove, uint32_t endStatus) {
+  return SESSION_RECORD_IN_USE |
+         (computerMask & SESSION_RECORD_MASK_BITS) |
+         ((playerMask & SESSION_RECORD_MASK_BITS) << SESSION_RECORD_PLAYER_SHIFT) |
+         ((computerToMove & 1) << SESSION_RECORD_SIDE_SHIFT) |
+         ((endStatus & 3) << SESSION_RECORD_STATUS_SHIFT);
+}
+
+static bool
+sessionRecordInUse(uint32_t record) {
+  return (record & SESSION_RECORD_IN_USE) != 0;
+}
+
+static uint32_t
+sessionRecordComputerMask(uint32_t record) {
+  return record & SESSION_RECORD_MASK_BITS;
+}
+
+static uint32_t
+sessionRecordPlayerMask(uint32_t record) {
+  return (record >> SESSION_RECORD_PLAYER_SHIFT) & SESSION_RECORD_MASK_BITS;
+}
+
+static uint32_t
+sessionRecordComputerToMove(uint32_t record) {
+  return (record >> SESSION_RECORD_SIDE_SHIFT) & 1;
+}
+
+static uint32_t
+sessionRecordEndStatus(uint32_t record) {
+  return (record >> SESSION_RECORD_STATUS_SHIFT) & 3;
+}
+
+static void
+sessionStoreClose(SessionStore* store) {
+#ifdef BUILD_WIN32
+  if (store->header) {
+    UnmapViewOfFile(store->header);
+  }
+  if (store->mapping) {
+    CloseHandle(store->mapping);
+  }
+  if (store->file && store->file != INVALID_HANDLE_VALUE) {
+    CloseHandle(store->file);
+  }
+#else
+  if (store->header) {
+    munmap(store->header, store->mappingSize);
+  }
+  if (store->file > 0) {
+    close(store->file);
+  }
+#endif
+  *store = {};
+}
+
+/*
+ * Reads the record count of the store at path without changing the file.
+ * Returns false when there is no file or it is not a complete store, that
+ * is, when sessionStoreOpen would reinitialize it.
+ */
+static bool
+sessionStoreReadRecordCount(char* path, uint32_t* recordCount) {
+  SessionStoreHeader header = {};
+  uint64_t fileSize = 0;
+#ifdef BUILD_WIN32
+  HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE,
+                            0, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
+  if (file == INVALID_HANDLE_VALUE) {
+    return false;
+  }
+  LARGE_INTEGER size;
+  DWORD bytesRead = 0;
+  bool headerRead = GetFileSizeEx(file, &size) &&
+                    ReadFile(file, &header, sizeof(header), &bytesRead, 0) &&
+                    bytesRead == sizeof(header);
+  fileSize = (uint64_t) size.QuadPart;
+  CloseHandle(file);
+#else
+  int file = open(path, O_RDONLY);
+  if (file < 0) {
+    return false;
+  }
+  struct stat fileStat;
+  bool headerRead = fstat(file, &fileStat) == 0 &&
+                    read(file, &header, sizeof(header)) == (ssize_t) sizeof(header);
+  fileSize = (uint64_t) fileStat.st_size;
+  close(file);
+#endif
+  if (!headerRead ||
+      header.magic != SESSION_STORE_MAGIC ||
+      header.version != SESSION_STORE_VERSION ||
+      fileSize != sizeof(SessionStoreHeader) + (uint64_t) header.recordCount * sizeof(uint32_t)) {
+    return false;
+  }
+  *recordCount = header.recordCount;
+  return true;
+}
+
+/*
+ * Opens (or creates) the store at path with room for recordCount sessions.
+ * An existing file with a different layout is discarded and reinitialized.
+ */
+static bool
+sessionStoreOpen(SessionStore* store, char* path, uint32_t recordCount) {
+  *store = {};
+  store->mappingSize = sizeof(SessionStoreHeader) +
+                       (size_t) recordCount * sizeof(uint32_t);
+  bool fresh = false;
+
+#ifdef BUILD_WIN32
+  store->file = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ,
+                            0, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, 0);
+  if (store->file == INVALID_HANDLE_VALUE) {
+    fprintf(stderr, "CreateFile Error: %lu\n", GetLastError());
+    sessionStoreClose(store);
+    return false;
+  }
+  LARGE_INTEGER fileSize;
+  if (!GetFileSizeEx(store->file, &fileSize)) {
+    fprintf(stderr, "GetFileSizeEx Error: %lu\n", GetLastError());
+    sessionStoreClose(store);
+    return false;
+  }
+  fresh = ((uint64_t) fileSize.QuadPart != store->mappingSize);
+  store->mapping = CreateFileMappingA(store->file, 0, PAGE_READWRITE,
+                                      (DWORD) ((uint64_t) store->mappingSize >> 32),
+                                      (DWORD) store->mappingSize, 0);
+  if (store->mapping == 0) {
+    fprintf(stderr, "CreateFileMapping Error: %lu\n", GetLastError());
+    sessionStoreClose(store);
+    return false;
+  }
+  store->header = (SessionStoreHeader*) MapViewOfFile(store->mapping, FILE_MAP_WRITE,
+                                                      0, 0, store->mappingSize);
+  if (store->header == 0) {
+    fprintf(stderr, "MapViewOfFile Error: %lu\n", GetLastError());
+    sessionStoreClose(store);
+    return false;
+  }
+#else
+  store->file = open(path, O_RDWR | O_CREAT, 0644);
+  if (store->file < 0) {
+    perror("open");
+    sessionStoreClose(store);
+    return false;
+  }
+  struct stat fileStat;
+  if (fstat(store->file, &fileStat) != 0) {
+    perror("fstat");
+    sessionStoreClose(store);
+    return false;
+  }
+  fresh = ((size_t) fileStat.st_size != store->mappingSize);
+  if (fresh && ftruncate(store->file, (off_t) store->mappingSize) != 0) {
+    perror("ftruncate");
+    sessionStoreClose(store);
+    return false;
+  }
+  void* mapping = mmap(0, store->mappingSize, PROT_READ | PROT_WRITE,
+                       MAP_SHARED, store->file, 0);
+  if (mapping == MAP_FAILED) {
+    perror("mmap");
+    sessionStoreClose(store);
+    return false;
+  }
+  store->header = (SessionStoreHeader*) mapping;
+#endif
+
+  store->records = (volatile uint32_t*) (store->header + 1);
+  store->recordCount = recordCount;
+
+  if (fresh ||
+      store->header->magic != SESSION_STORE_MAGIC ||
+      store->header->version != SESSION_STORE_VERSION ||
+      store->header->recordCount != recordCount) {
+    // The magic is written last so an interrupted initialization is
+    // detected and redone on the next open.
+    store->header->magic = 0;
+    memset((void*) store->records, 0, (size_t) recordCount * sizeof(uint32_t));
+    store->header->version = SESSION_STORE_VERSION;
+    store->header->recordCount = recordCount;
+    store->header->reserved = 0;
+    store->header->magic = SESSION_STORE_MAGIC;
+  }
+  return true;
+}
+
+static uint32_t
+sessionStoreLoad(SessionStore* store, uint32_t index) {
+  assert(index < store->recordCount);
+  return store->records[index];
+}
+
+static void
+sessionStoreSave(SessionStore* store, uint32_t index, uint32_t record) {
+  assert(index < store->recordCount);
+  store->records[index] = record;
+}
+
+/*
+ * The mapping already survives a process crash; flushing only matters for
+ * the session to also survive an OS crash or power loss.
+ */
+static void
+sessionStoreFlush(SessionStore* store) {
+  if (!store->header) {
+    return;
+  }
+#ifdef BUILD_WIN32
+  FlushViewOfFile(store->header, 0);
+#else
+  msync(store->header, store->mappingSize, MS_ASYNC);
+#endif
+}
+
+#endif
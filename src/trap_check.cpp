@@ -0,0 +1,338 @@
+/*
+ * Internal tool, built next to the game by build.sh and build.bat but never
+ * part of it: checks the computer's trap stage against the analysis solver
+ * and times it against the heuristics it replaced.
+ *
+ *   trap-check [repetitions]
+ *
+ * Exits with 1 when a fork mask is wrong or a trap move loses.
+ */
+#define BUILD_TOOL 1
+#include "main.cpp"
+
+#define TRAP_CHECK_ROUNDS 10
+
+/*
+ * The trap heuristics as they were before the mask-based fork detection,
+ * copied unchanged as the baseline to compare against, board[2][columnC]
+ * slip included.
+ */
+static bool
+oldTrapMoveNoCenter(GameState* gameState, TileValue tileValue, 
+                    int rowA, int columnA) {
+
+  if (gameState->board[rowA][columnA] != tileValue) {
+    return false;
+  }
+  int rowB = 1;
+  int rowC = 2;
+  switch (rowA) {
+    case 1: {
+      rowB = 0;
+      rowC = 2;
+    } break;
+    case 2: {
+      rowB = 0;
+      rowC = 1;
+    } break;
+  }
+  int columnB = 1;
+  int columnC = 2;
+  switch (columnA) {
+    case 1: {
+      columnB = 0;
+      columnC = 2;
+    } break;
+    case 2: {
+      columnB = 0;
+      columnC = 1;
+    } break;
+  }
+
+  if (((gameState->board[rowA][columnB] == tileValue && gameState->board[rowA][columnC] == EMPTY_TILE) || 
+       (gameState->board[rowA][columnC] == tileValue && gameState->board[rowA][columnB] == EMPTY_TILE)) &&
+      gameState->board[rowB][columnA] == EMPTY_TILE &&
+      gameState->board[rowC][columnA] == EMPTY_TILE) {
+    gameState->board[rowB][columnA] = COMPUTER_TILE;  
+    --gameState->freeTilesCount;  
+    return true;
+  } 
+  if (((gameState->board[rowB][columnA] == tileValue && gameState->board[rowC][columnA] == EMPTY_TILE) || 
+       (gameState->board[rowC][columnA] == tileValue && gameState->board[rowB][columnA] == EMPTY_TILE)) &&
+      gameState->board[rowA][columnB] == EMPTY_TILE &&
+      gameState->board[rowA][columnC] == EMPTY_TILE) {
+    gameState->board[rowA][columnB] = COMPUTER_TILE;  
+    --gameState->freeTilesCount;  
+    return true;
+  } 
+  if (((gameState->board[rowA][columnB] == tileValue && gameState->board[rowA][columnC] == EMPTY_TILE) || 
+       (gameState->board[rowA][columnC] == tileValue && gameState->board[rowA][columnB] == EMPTY_TILE)) &&
+      gameState->board[rowB][columnB] == EMPTY_TILE &&
+      gameState->board[rowC][columnC] == EMPTY_TILE) {
+    gameState->board[rowB][columnB] = COMPUTER_TILE;  
+    --gameState->freeTilesCount;  
+    return true;
+  } 
+  if (((gameState->board[rowB][columnB] == tileValue && gameState->board[2][columnC] == EMPTY_TILE) || 
+       (gameState->board[rowC][columnC] == tileValue && gameState->board[rowB][columnB] == EMPTY_TILE)) &&
+      gameState->board[rowA][columnB] == EMPTY_TILE &&
+      gameState->board[rowA][columnC] == EMPTY_TILE) {
+    gameState->board[rowA][columnB] = COMPUTER_TILE;  
+    --gameState->freeTilesCount;  
+    return true;
+  } 
+  if (((gameState->board[rowB][columnA] == tileValue && gameState->board[rowC][columnA] == EMPTY_TILE) || 
+       (gameState->board[rowC][columnA] == tileValue && gameState->board[rowB][columnA] == EMPTY_TILE)) &&
+      gameState->board[rowB][columnB] == EMPTY_TILE &&
+      gameState->board[rowC][columnC] == EMPTY_TILE) {
+    gameState->board[rowB][columnB] = COMPUTER_TILE;  
+    --gameState->freeTilesCount;  
+    return true;
+  } 
+  if (((gameState->board[rowB][columnB] == tileValue && gameState->board[rowC][columnC] == EMPTY_TILE) || 
+       (gameState->board[rowC][columnC] == tileValue && gameState->board[rowB][columnB] == EMPTY_TILE)) &&
+      gameState->board[rowB][columnA] == EMPTY_TILE &&
+      gameState->board[rowC][columnA] == EMPTY_TILE) {
+    gameState->board[rowB][columnA] = COMPUTER_TILE;  
+    --gameState->freeTilesCount;  
+    return true;
+  } 
+
+  return false;
+}
+
+static bool
+oldTrapMoveCenter(GameState* gameState, TileValue tileValue) {
+  return false;
+}
+
+static bool
+oldTrapMove(GameState* gameState, TileValue tileValue) {
+  for (int row = 0; row < 3; ++row) {
+    for (int column = 0; column < 3; ++column) {
+      if ((row != 2) && (column != 2)) {
+        if (oldTrapMoveNoCenter(gameState, COMPUTER_TILE, row, column)) {
+          return true;
+        }
+      } else {
+         if (oldTrapMoveCenter(gameState, COMPUTER_TILE)) {
+          return true;
+        }
+      }
+    }
+  }
+  for (int row = 0; row < 3; ++row) {
+    for (int column = 0; column < 3; ++column) {
+      if ((row != 2) && (column != 2)) {
+        if (oldTrapMoveNoCenter(gameState, PLAYER_TILE, row, column)) {
+          return true;
+        }
+      } else {
+         if (oldTrapMoveCenter(gameState, PLAYER_TILE)) {
+          return true;
+        }
+      }
+    }
+  }
+  return false;
+}
+
+struct TrapCheckResult {
+  int moves;
+  int winToDraw;
+  int winToLoss;
+  int drawToLoss;
+};
+
+static GameState
+checkTrapGameState(uint32_t computerMask, uint32_t playerMask) {
+  GameState gameState;
+  gameStateUnpack(&gameState, sessionRecordPack(computerMask, playerMask, 1, NO_END));
+  return gameState;
+}
+
+/*
+ * Compares the value of the trap move against the best value of the
+ * position, both from the computer's side, using the analysis solver.
+ */
+static void
+checkTrapMove(AnalysisCache* analysisCache, GameState* before, GameState* after,
+              TrapCheckResult* result) {
+  uint32_t computerMask;
+  uint32_t playerMask;
+  gameBoardMasks(before, &computerMask, &playerMask);
+  int bestTile;
+  AnalysisValue bestValue = analysisEvaluate(analysisCache, computerMask, playerMask, &bestTile);
+  gameBoardMasks(after, &computerMask, &playerMask);
+  AnalysisValue moveValue = (AnalysisValue)
+    (ANALYSIS_WIN - analysisEvaluate(analysisCache, computerMask, playerMask, &bestTile));
+  ++result->moves;
+  if (bestValue == ANALYSIS_WIN && moveValue == ANALYSIS_DRAW) {
+    ++result->winToDraw;
+  } else if (bestValue == ANALYSIS_WIN && moveValue == ANALYSIS_LOSS) {
+    ++result->winToLoss;
+  } else if (bestValue == ANALYSIS_DRAW && moveValue == ANALYSIS_LOSS) {
+    ++result->drawToLoss;
+  }
+}
+
+static void
+checkTrapPrint(char* name, TrapCheckResult* result) {
+  printf("%s trap moves: %d, win -> draw: %d, win -> loss: %d, draw -> loss: %d\n",
+         name, result->moves, result->winToDraw, result->winToLoss, result->drawToLoss);
+}
+
+/*
+ * Checks the trap stage of the computer against a perfect solver on every
+ * position where the computer is to move and no line move applies, checks
+ * the fork tiles of both sides against a brute force count of threats on
+ * every board, and times the trap stage against the old heuristics. Fails
+ * when a fork mask is wrong or a trap move turns a draw or a win into a loss.
+ */
+static int
+checkTrap(int repetitions) {
+  static AnalysisCache analysisCache;
+  analysisCacheInit(&analysisCache);
+
+  int forkBoards = 0;
+  int forkMismatches = 0;
+  static GameState positions[BOARD_MASK + 1];
+  static uint32_t computerMasks[BOARD_MASK + 1];
+  static uint32_t playerMasks[BOARD_MASK + 1];
+  int positionCount = 0;
+  TrapCheckResult newResult = {};
+  TrapCheckResult oldResult = {};
+
+  for (uint32_t computerMask = 0; computerMask <= BOARD_MASK; ++computerMask) {
+    for (uint32_t playerMask = 0; playerMask <= BOARD_MASK; ++playerMask) {
+      if (computerMask & playerMask) {
+        continue;
+      }
+      GameLines lines = gameScanLines(computerMask, playerMask);
+      uint32_t emptyMask = BOARD_MASK & ~(computerMask | playerMask);
+      for (int side = 0; side < 2; ++side) {
+        uint32_t ownMask = side ? playerMask : computerMask;
+        uint32_t otherMask = side ? computerMask : playerMask;
+        uint32_t expected = 0;
+        for (int tileIndex = 0; tileIndex < 9; ++tileIndex) {
+          uint32_t tileBit = 1u << tileIndex;
+          if ((ownMask | otherMask) & tileBit) {
+            continue;
+          }
+          int threats = 0;
+          for (int line = 0; line < 8; ++line) {
+            uint32_t lineMask = LINE_MASKS[line];
+            if ((lineMask & tileBit) && (lineMask & otherMask) == 0 &&
+                countBits((ownMask | tileBit) & lineMask) == 2) {
+              ++threats;
+            }
+          }
+          if (threats >= 2) {
+            expected |= tileBit;
+          }
+        }
+        ++forkBoards;
+        uint32_t forkTiles = side ? lines.playerForkTiles : lines.computerForkTiles;
+        uint32_t openLines = side ? lines.playerLines : lines.computerLines;
+        forkMismatches += (forkTiles != expected ||
+                           gameForkTiles(openLines, emptyMask) != expected);
+      }
+
+      // Only reachable positions: the player opened and it is the computer's turn.
+      if (countBits(playerMask) != countBits(computerMask) + 1 ||
+          analysisMaskHasLine(computerMask) || analysisMaskHasLine(playerMask) ||
+          (computerMask | playerMask) == BOARD_MASK) {
+        continue;
+      }
+      GameState position = checkTrapGameState(computerMask, playerMask);
+      GameState lineMove = position;
+      if (gameUpdateLineMove(&lineMove, COMPUTER_TILE) ||
+          gameUpdateLineMove(&lineMove, PLAYER_TILE)) {
+        continue;
+      }
+      computerMasks[positionCount] = computerMask;
+      playerMasks[positionCount] = playerMask;
+      positions[positionCount++] = position;
+
+      GameState newMove = position;
+      if (gameUpdateTrapMove(&newMove, computerMask, playerMask)) {
+        checkTrapMove(&analysisCache, &position, &newMove, &newResult);
+      }
+      GameState oldMove = position;
+      if (oldTrapMove(&oldMove, COMPUTER_TILE) ||
+          oldTrapMove(&oldMove, PLAYER_TILE)) {
+        checkTrapMove(&analysisCache, &position, &oldMove, &oldResult);
+      }
+    }
+  }
+
+  printf("fork masks: %d boards, %d mismatches\n", forkBoards, forkMismatches);
+  printf("positions without a line move: %d\n", positionCount);
+  checkTrapPrint((char*) "new", &newResult);
+  checkTrapPrint((char*) "old", &oldResult);
+
+  // The stages run in alternating rounds and each keeps its fastest round,
+  // which is the least disturbed by whatever else runs on the machine. The
+  // board masks are timed on their own: gameUpdateComputer takes them once
+  // per move and shares them with the other stages.
+  double frequency = (double) SDL_GetPerformanceFrequency();
+  double positionsPerRound = (double) repetitions * positionCount;
+  double newNanos = 0.0;
+  double masksNanos = 0.0;
+  double oldNanos = 0.0;
+  uint32_t moved = 0;
+  for (int round = 0; round < TRAP_CHECK_ROUNDS; ++round) {
+    Uint64 start = SDL_GetPerformanceCounter();
+    for (int repetition = 0; repetition < repetitions; ++repetition) {
+      for (int index = 0; index < positionCount; ++index) {
+        GameState gameState = positions[index];
+        moved += gameUpdateTrapMove(&gameState, computerMasks[index], playerMasks[index]);
+      }
+    }
+    Uint64 end = SDL_GetPerformanceCounter();
+    double nanos = 1e9 * (end - start) / frequency / positionsPerRound;
+    if (round == 0 || nanos < newNanos) {
+      newNanos = nanos;
+    }
+
+    start = SDL_GetPerformanceCounter();
+    for (int repetition = 0; repetition < repetitions; ++repetition) {
+      for (int index = 0; index < positionCount; ++index) {
+        GameState gameState = positions[index];
+        uint32_t computerMask;
+        uint32_t playerMask;
+        gameBoardMasks(&gameState, &computerMask, &playerMask);
+        moved += computerMask ^ playerMask;
+      }
+    }
+    end = SDL_GetPerformanceCounter();
+    nanos = 1e9 * (end - start) / frequency / positionsPerRound;
+    if (round == 0 || nanos < masksNanos) {
+      masksNanos = nanos;
+    }
+
+    start = SDL_GetPerformanceCounter();
+    for (int repetition = 0; repetition < repetitions; ++repetition) {
+      for (int index = 0; index < positionCount; ++index) {
+        GameState gameState = positions[index];
+        moved += oldTrapMove(&gameState, COMPUTER_TILE) ||
+                 oldTrapMove(&gameState, PLAYER_TILE);
+      }
+    }
+    end = SDL_GetPerformanceCounter();
+    nanos = 1e9 * (end - start) / frequency / positionsPerRound;
+    if (round == 0 || nanos < oldNanos) {
+      oldNanos = nanos;
+    }
+  }
+  printf("trap stage: new %.1f ns/position, old %.1f ns/position (best of %d rounds)\n",
+         newNanos, oldNanos, TRAP_CHECK_ROUNDS);
+  printf("board masks: %.1f ns/position, once per move (checksum %u)\n", masksNanos, moved);
+
+  return (forkMismatches || newResult.winToLoss || newResult.drawToLoss) ? 1 : 0;
+}
+
+int
+main(int argc, char** argv) {
+  return checkTrap((argc >= 2) ? atoi(argv[1]) : 200);
+}